@@ -0,0 +1,94 @@
+#include "claim_cache.h"
+#include "messages.h"
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+
+//FNV-1a, so keys stay the same from one run to the next.
+static uint64_t fnv_hash(const std::string& text) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : text) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static std::string to_hex(uint64_t value) {
+  char buffer[17];
+  snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long) value);
+  return std::string(buffer);
+}
+
+claim_cache::claim_cache(const std::string& path, const std::string& signature) : path(path) {
+  this->signature = to_hex(fnv_hash(signature));
+  std::ifstream file(path);
+  if (file.fail())
+    return;
+  std::string line;
+  std::getline(file, line);
+  if (line != "signature " + this->signature) {
+    debug_print(DEBUG_INFO, 1, "claim cache: drivers changed, ignoring cached claims");
+    return;
+  }
+  //Each line: syspath hash manager (manager is "-" when nothing claimed it)
+  while (std::getline(file, line)) {
+    std::stringstream stream(line);
+    std::string syspath, hash, manager;
+    stream >> syspath >> hash >> manager;
+    if (syspath.empty() || hash.empty() || manager.empty())
+      continue;
+    previous[syspath + " " + hash] = (manager == "-") ? "" : manager;
+  }
+}
+
+std::string claim_cache::device_key(udev_device* dev) {
+  const char* syspath = udev_device_get_syspath(dev);
+  if (!syspath)
+    return "";
+  //Whatever tells apart two devices that could show up at the same syspath.
+  static const char* properties[] = {"PRODUCT", "NAME", "HID_ID", "HID_NAME", "HID_UNIQ", "HID_PHYS", nullptr};
+  std::string identity;
+  udev_device* parent = udev_device_get_parent(dev);
+  for (udev_device* node : {dev, parent}) {
+    if (!node)
+      continue;
+    for (int i = 0; properties[i]; i++) {
+      const char* value = udev_device_get_property_value(node, properties[i]);
+      identity += value ? value : "";
+      identity += '\n';
+    }
+  }
+  return std::string(syspath) + " " + to_hex(fnv_hash(identity));
+}
+
+bool claim_cache::lookup(udev_device* dev, std::string& manager) const {
+  auto it = previous.find(device_key(dev));
+  if (it == previous.end())
+    return false;
+  manager = it->second;
+  return true;
+}
+
+void claim_cache::record(udev_device* dev, const std::string& manager) {
+  std::string key = device_key(dev);
+  if (!key.empty())
+    recorded[key] = manager;
+}
+
+bool claim_cache::save() const {
+  std::string temp_path = path + ".tmp";
+  std::ofstream file(temp_path);
+  if (file.fail())
+    return false;
+  file << "signature " << signature << "\n";
+  for (auto& entry : recorded)
+    file << entry.first << " " << (entry.second.empty() ? "-" : entry.second) << "\n";
+  file.close();
+  if (file.fail() || rename(temp_path.c_str(), path.c_str()) < 0) {
+    remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,35 @@
+#ifndef CLAIM_CACHE_H
+#define CLAIM_CACHE_H
+
+#include <libudev.h>
+#include <string>
+#include <unordered_map>
+
+//Remembers which manager ended up claiming each device during startup
+//enumeration, so the next start can offer the device straight to that
+//manager instead of running it past every manager and gendev rule.
+//
+//Devices are keyed by syspath plus a hash of their identifying properties.
+//The whole cache is thrown out when the signature (the loaded managers and
+//gendev files) differs from the one it was written with.
+class claim_cache {
+public:
+  claim_cache(const std::string& path, const std::string& signature);
+
+  //False on a miss. On a hit, manager is the claiming manager's name,
+  //or empty if no manager claimed the device.
+  bool lookup(udev_device* dev, std::string& manager) const;
+  void record(udev_device* dev, const std::string& manager);
+  //Replaces the file with what was recorded since construction.
+  bool save() const;
+
+private:
+  std::string path;
+  std::string signature;
+  std::unordered_map<std::string, std::string> previous;
+  std::unordered_map<std::string, std::string> recorded;
+
+  static std::string device_key(udev_device* dev);
+};
+
+#endif
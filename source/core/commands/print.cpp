@@ -134,6 +134,8 @@ int do_print_slot(output_slot* slot, bool details, std::ostream& out) {
     for (auto e : slot->options) {
       out << "\t" << e.first << " = " << e.second << std::endl;
     }
+    if (slot->get_suppressed_count())
+      out << "\tduplicate events suppressed: " << slot->get_suppressed_count() << std::endl;
   }
 };
 
@@ -9,6 +9,7 @@
 #include <mutex>
 #include <time.h>
 #include "../event_translators/event_change.h"
+#include "../event_translators/trans_op.h"
 #include "../moltengamepad.h"
 #include "../profile.h"
 #include "../messages.h"
@@ -36,12 +37,15 @@ struct source_event {
 
 struct event_mapping {
   event_translator* trans;
-  std::vector<advanced_event_translator*> attached;
 };
 
+//Something to run at a regular period, like mouse emulation.
 struct recurring_info {
-  const event_translator* trans;
+  const event_translator* trans;        //either a translator for event id...
+  const advanced_event_translator* adv; //...or an advanced translator.
   int id;
+  int64_t period; //nanoseconds between runs
+  int64_t due;    //when it should next run, in CLOCK_MONOTONIC nanoseconds
 };
 
 struct adv_entry {
@@ -49,8 +53,10 @@ struct adv_entry {
   advanced_event_translator* trans;
 };
 
-//Struct used internally, not designed for public consumption.
+//Structs used internally, not designed for public consumption.
 struct input_internal_msg;
+struct input_msg_queue;
+class event_engine;
 
 class input_source : public std::enable_shared_from_this<input_source> {
 public:
@@ -101,10 +107,10 @@ public:
 
   void* const plug_data = nullptr;
   friend void init_plugin_api();
+  friend class event_engine;
 protected:
   int epfd = 0;
-  int priv_pipe = 0;
-  int internalpipe = 0;
+  input_msg_queue* msg_queue = nullptr;
   std::string name = "unnamed";
   std::string descr = "No description available";
   std::string device_type = "gamepad";
@@ -112,11 +118,25 @@ protected:
   std::string phys = ""; //A string describing how/where this device is connected, if available.
   std::vector<source_event> events;
   std::vector<event_mapping> ev_map;
+  //ev_map compiled to ops: those for event id are program[program_start[id]] up to program[program_start[id+1]]
+  std::vector<trans_op> program;
+  std::vector<int> program_start;
+  bool program_dirty = true;
+  //Advanced translators listening to event id are listeners[listener_start[id]]
+  //up to listeners[listener_start[id+1]]. Bit id of listener_bits says whether there are any.
+  std::vector<advanced_event_translator*> listeners;
+  std::vector<int> listener_start = std::vector<int>(1, 0);
+  std::vector<uint64_t> listener_bits;
   std::map<std::string, option_info> options;
   std::map<std::string, adv_entry> adv_trans;
   std::shared_ptr<profile> devprofile = std::make_shared<profile>();
   std::thread* thread = nullptr;
+  event_engine* engine = nullptr; //set when a shared engine runs our loop instead
   volatile bool keep_looping = true;
+  int batch_size = 1; //How many ready files to handle per epoll_wait.
+  bool in_batch = false; //Defer SYN_REPORTs until the whole batch is processed.
+  bool syn_pending = false;
+  bool file_synced = false; //The file being processed already ended a frame in this batch.
   device_manager* manager;
   device_plugin plugin;
   std::mutex opt_lock;
@@ -125,22 +145,35 @@ protected:
   output_slot* assigned_slot = nullptr; //might differ from the above due to thread synchro.
   int ff_ids[1]; //Since the physical device might hand us different ids.
 
+  //Kept as a min-heap on due time, so only what is due gets looked at.
   std::vector<recurring_info> recurring_events;
-  std::vector<const advanced_event_translator*> adv_recurring_events;
+  std::vector<recurring_info> parked_recurring; //idle, so off the schedule
   bool do_recurring_events = false;
-  timespec last_recurring_update;
+  int recurring_timer = -1; //timerfd armed for the earliest due time
+  bool event_mask_dirty = false; //Mappings changed since the plugin was last told.
+  std::vector<unsigned char> masked_events; //what the plugin was last told to mask
 
 
   void register_event(event_decl ev);
   void toggle_event(int id, event_state state);
   void register_option(option_info opt);
   void watch_file(int fd, void* tag);
+  void unwatch_file(int fd);
   void set_trans(int id, event_translator* trans);
   void force_value(int id, int64_t value);
   void send_value(int id, int64_t value);
   void send_syn_report();
+  void write_syn_report();
+  void end_file_frame();
+  void compile_program();
+  void run_program(int id, int64_t value);
+  bool has_listeners(int id) const {
+    return (listener_bits[id >> 6] >> (id & 63)) & 1;
+  };
 
   void thread_loop();
+  bool dispatch(int timeout);
+  int recurring_timeout();
 
   void process(void* tag);
   int process_option(const char* opname, const MGField field);
@@ -148,14 +181,20 @@ protected:
   void print(std::string message);
   
   void handle_internal_message(input_internal_msg& msg);
+  void drain_internal_messages();
 
   void add_recurring_event(const event_translator* trans, int id);
   void remove_recurring_event(const event_translator* trans);
   void add_adv_recurring_event(const advanced_event_translator* trans);
   void remove_adv_recurring_event(const advanced_event_translator* trans);
 
+  void update_event_mask();
+  void add_recurring(recurring_info info);
+  void drop_recurring(const void* trans);
+  void wake_recurring();
   void process_recurring_events();
-  int64_t ms_since_last_recurring_update();
+  bool recurring_due();
+  void arm_recurring_timer();
 };
 
 class device_manager {
@@ -6,6 +6,9 @@
 #include <iostream>
 #include <mutex>
 #include <fstream>
+#include <bitset>
+#include <memory>
+#include <unordered_map>
 #include <unistd.h>
 #include <linux/input.h>
 #include "../../../plugin/plugin.h"
@@ -40,6 +43,27 @@ struct device_match {
 
 int parse_hex(const std::string& text);
 
+//The key and abs codes a device supports (or a driver wants), one bit per code.
+//Bitsets let the event match rules compare whole words at a time.
+struct ev_capabilities {
+  std::bitset<KEY_CNT> key;
+  std::bitset<ABS_CNT> abs;
+};
+
+//Everything the match lines look at, gathered once per udev device
+//instead of once per match line.
+struct udev_match_info {
+  udev_device* parent = nullptr;
+  const char* name = nullptr;
+  const char* phys = nullptr;
+  const char* uniq = nullptr;
+  const char* driver = nullptr;
+  int vendor = -1;
+  int product = -1;
+  bool caps_loaded = false; //only read capabilities if some match line wants them
+  std::shared_ptr<const ev_capabilities> caps;
+};
+
 //Info on an event as read from the .cfg file
 struct gen_source_event {
   int code; //e.g. BTN_SOUTH or ABS_X
@@ -76,6 +100,14 @@ struct generic_driver_info {
 int generic_config_loop(moltengamepad* mg, std::istream& in, std::string& path);
 int add_generic_manager(moltengamepad* mg, generic_driver_info& info);
 
+class generic_device;
+
+//Most input_events taken from an event node or pipe per read().
+//64 events fit in one atomic pipe write (PIPE_BUF).
+#define EVDEV_READ_BATCH 64
+//Most ready files handled per epoll_wait in generic_file::thread_loop
+#define GENERIC_FILE_MAX_EVENTS 8
+
 struct generic_node {
   std::string path;
   udev_device* node;
@@ -105,11 +137,25 @@ public:
   bool grab_chmod = false;
   bool keep_looping = true;
   bool rumble = false;
+  //In direct mode there is no thread here: the single generic_device
+  //watches our event nodes itself and reads them on its own thread.
+  bool direct = false;
+  generic_device* direct_dev = nullptr;
   moltengamepad* mg;
 
+  //Which split devices want each code: bit i stands for devices[i].
+  //Devices past the 64th are sent everything.
+  std::vector<uint64_t> key_routes;
+  std::vector<uint64_t> abs_routes;
+  std::vector<bool> in_frame; //devices[i] was sent events since its last SYN_REPORT
+  std::vector<std::vector<input_event>> routed; //per-device output, reused between reads
+  //Only touched by our thread: routed events waiting to be written, and where to.
+  std::vector<std::vector<input_event>> outgoing;
+  std::vector<int> outgoing_fds;
+
   int internal_pipe[2];
 
-  generic_file(moltengamepad* mg, struct udev_device* node, bool grab_ioctl, bool grab_chmod, bool rumble);
+  generic_file(moltengamepad* mg, struct udev_device* node, bool grab_ioctl, bool grab_chmod, bool rumble, bool direct);
 
   ~generic_file();
 
@@ -117,13 +163,32 @@ public:
   void close_node(struct udev_device* node, bool erase);
   void close_node(const std::string& path, bool erase);
   void add_dev(input_source* dev);
+  void watch_direct(generic_device* dev);
   void thread_loop();
+  void forward_events(int fd);
+  void route_events(const input_event* evs, int count);
   int get_fd();
+  std::vector<int> get_fds();
+  void set_event_mask(generic_device* dev, std::vector<uint8_t>& key_mask, std::vector<uint8_t>& abs_mask);
+  void apply_event_masks(int fd);
 
 };
 
-typedef std::pair<int, int> evcode;
-typedef std::pair<int, input_absinfo> decodedevent;
+//Fractional bits in decoded_axis::mult
+#define ABS_SCALE_SHIFT 64
+
+//What we need to translate a raw EV_ABS event into one of our events.
+//Rescaling is precomputed as a fixed-point multiplier, so no division is needed.
+struct decoded_axis {
+  int id = -1; //-1 if this code is not one of our events.
+  int32_t minimum = 0;
+  int32_t maximum = 0;
+  unsigned __int128 mult = 0; //(2*ABS_RANGE << ABS_SCALE_SHIFT) / range, rounded up. 0 passes values through.
+  int32_t flat_low = 1; //raw values within [flat_low, flat_high] are reported as centered
+  int32_t flat_high = 0;
+};
+
+void decode_axis(decoded_axis& axis, int id, const input_absinfo& info);
 
 class generic_device {
 public:
@@ -134,7 +199,9 @@ public:
   bool rumble = false;
   const std::string type;
 
-  std::map<evcode, decodedevent> eventcodes;
+  //Indexed directly by evdev code.
+  int key_ids[KEY_CNT]; //-1 if this code is not one of our events.
+  decoded_axis axes[ABS_CNT];
   struct udev_device* node = nullptr;
 
   generic_device(std::vector<split_ev_info>& split_events, int total_events, generic_file* file, const std::string& type, bool rumble);
@@ -143,6 +210,17 @@ public:
   int init(input_source* ref);
 
   void process(void*);
+  int read_events(int fd);
+  void update_event_mask(int count, const unsigned char* wanted);
+  //Codes this device wants from the kernel, as evdev bitmaps. Guarded by file->lock.
+  bool has_mask = false;
+  std::vector<uint8_t> key_mask;
+  std::vector<uint8_t> abs_mask;
+  void resync();
+  bool dropped = false; //Saw SYN_DROPPED, discarding events until the next SYN_REPORT.
+
+  //Event nodes read directly are tagged with their fd, so they can't be confused with &pipe_read.
+  static void* direct_tag(int fd) { return (void*)(intptr_t)fd; };
 
   int get_pipe();
   input_source* ref = nullptr;
@@ -153,6 +231,43 @@ public:
   int erase_ff(int id);
   int play_ff(int id, int repetitions);
 
+  void rescale_axes(const int* codes, const int32_t* values, int64_t* scaled, int count) const;
+};
+
+class generic_manager;
+
+//Index over the match lines of every generic manager.
+//
+//Lines naming a vendor (and product) or an exact device name are hashed on
+//those; the rest go to a residual list that is checked for every device.
+//A lookup gives each manager just the lines that could match the device,
+//ordered so claims come before deferred claims. Since the same udev device
+//is offered to every manager in turn, the last lookup is kept and reused.
+class generic_match_index {
+public:
+  void add(generic_manager* manager);
+  void remove(generic_manager* manager);
+  //Fills in info for dev and returns the lines of manager worth checking.
+  std::vector<const device_match*> candidates(udev_device* dev, generic_manager* manager, udev_match_info& info);
+
+private:
+  struct entry {
+    generic_manager* manager;
+    const device_match* match;
+    int position; //index within the manager's own match list
+  };
+  std::unordered_map<uint64_t, std::vector<entry>> by_ids; //vendor << 32 | product
+  std::unordered_map<int, std::vector<entry>> by_vendor;
+  std::unordered_map<std::string, std::vector<entry>> by_name;
+  std::vector<entry> residual;
+  std::mutex lock;
+
+  //The lookup for the device currently being offered around.
+  //We hold a reference, so the pointer cannot be reused by another device.
+  udev_device* last_dev = nullptr;
+  udev_match_info last_info;
+  std::unordered_map<generic_manager*, std::vector<const device_match*>> last_candidates;
+  void forget_last();
 };
 
 class generic_manager {
@@ -164,6 +279,7 @@ public:
   static manager_methods methods;
   moltengamepad* mg;
   int event_count = 0;
+  static generic_match_index match_index;
 
   generic_manager(moltengamepad* mg, generic_driver_info& descr);
   manager_plugin get_plugin();
@@ -178,6 +294,8 @@ protected:
   std::mutex devlistlock;
   std::vector<generic_file*> openfiles;
   std::vector<std::vector<split_ev_info>> splitevents;
+  ev_capabilities driver_events; //every key/abs listed in the driver config
+  bool other_events = false; //the config also lists events that are neither key nor abs
   int dev_counter = 0;
   std::string devname = "";
   int open_device(struct udev* udev, struct udev_device* dev);
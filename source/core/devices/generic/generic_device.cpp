@@ -1,7 +1,45 @@
 #include "generic.h"
+#include <errno.h>
 
 device_methods generic_device::methods;
 
+void decode_axis(decoded_axis& axis, int id, const input_absinfo& info) {
+  axis.id = id;
+  axis.minimum = info.minimum;
+  axis.maximum = info.maximum;
+  int64_t range = (int64_t)info.maximum - info.minimum;
+  //Without a usable range, values are passed along as-is.
+  //Rounding up adds an error below offset/2^ABS_SCALE_SHIFT before the final shift.
+  //With 64 fractional bits that stays under 1/range for any 32-bit range, so the
+  //result matches (value - min) * 2*ABS_RANGE / range exactly.
+  axis.mult = range > 0 ? (((unsigned __int128)(2 * ABS_RANGE) << ABS_SCALE_SHIFT) + range - 1) / range : 0;
+  if (info.flat > 0 && range > 0) {
+    int64_t center = ((int64_t)info.minimum + info.maximum) / 2;
+    axis.flat_low = center - info.flat;
+    axis.flat_high = center + info.flat;
+  } else {
+    axis.flat_low = 1;
+    axis.flat_high = 0;
+  }
+}
+
+static inline int64_t rescale_axis(const decoded_axis& axis, int32_t value) {
+  if (!axis.mult)
+    return value;
+  if (value >= axis.flat_low && value <= axis.flat_high)
+    return 0;
+  //Clamp so (value - minimum) never exceeds the range; the product then fits in 128 bits.
+  if (value < axis.minimum) value = axis.minimum;
+  if (value > axis.maximum) value = axis.maximum;
+  uint64_t offset = (uint64_t)((int64_t)value - axis.minimum);
+  return -ABS_RANGE + (int64_t)((offset * axis.mult) >> ABS_SCALE_SHIFT);
+}
+
+void generic_device::rescale_axes(const int* codes, const int32_t* values, int64_t* scaled, int count) const {
+  for (int i = 0; i < count; i++)
+    scaled[i] = rescale_axis(axes[codes[i]], values[i]);
+}
+
 generic_device::generic_device(std::vector<split_ev_info>& split_events, int total_events, generic_file* file, const std::string& type, bool rumble) : type(type), rumble(rumble) {
   int fd = file->get_fd();
   this->file = file;
@@ -13,6 +51,9 @@ generic_device::generic_device(std::vector<split_ev_info>& split_events, int tot
     eventstates[i] = EVENT_DISABLED;
   }
 
+  for (int i = 0; i < KEY_CNT; i++)
+    key_ids[i] = -1;
+
   for (int i = 0; i < split_events.size(); i++) {
     
     input_absinfo     abs;
@@ -23,19 +64,18 @@ generic_device::generic_device(std::vector<split_ev_info>& split_events, int tot
     eventstates[ev.id] = EVENT_ACTIVE;
     
 
-    int type = EV_KEY;
-    if (ev.type == DEV_AXIS) type = EV_ABS;
-    if (ev.type == DEV_REL)  type = EV_REL;
+    //If a code is listed twice, the first listing wins.
+    if (ev.type == DEV_KEY && ev.code >= 0 && ev.code < KEY_CNT && key_ids[ev.code] < 0)
+      key_ids[ev.code] = ev.id;
 
-    evcode code(type, ev.code);
     //Read in ABS ranges so we can rescale the generated events
-    if (ev.type == DEV_AXIS) {
+    if (ev.type == DEV_AXIS && ev.code >= 0 && ev.code < ABS_CNT && axes[ev.code].id < 0) {
       if (ioctl(fd, EVIOCGABS(split_events[i].code), &abs)) {
         perror("evdev EVIOCGABS ioctl");
       }
+      decode_axis(axes[ev.code], ev.id, abs);
     }
-    decodedevent decoded(ev.id, abs);
-    eventcodes.insert(std::pair<evcode, decodedevent>(code, decoded));
+    //Relative events are registered, but not yet read from generic devices.
   }
 }
 
@@ -44,8 +84,14 @@ int generic_device::init(input_source* ref) {
   for (int i = 0; i < total_events; i++)
     methods.toggle_event(ref, i, eventstates[i]);
 
+  if (file->direct) {
+    file->watch_direct(this);
+    return 0;
+  }
+
   int internal[2];
   pipe(internal);
+  fcntl(internal[0], F_SETFL, O_NONBLOCK);
   methods.watch_file(ref, internal[0], &pipe_read);
   pipe_write = internal[1];
   pipe_read = internal[0];
@@ -58,36 +104,141 @@ generic_device::~generic_device() {
 }
 
 void generic_device::process(void* tag) {
-  struct input_event ev;
-  int file = pipe_read;
-  int ret = read(file, &ev, sizeof(ev));
-  if (ret > 0) {
-    if (ev.type == EV_SYN) {
-      methods.send_syn_report(ref);
-    }
-    evcode code(ev.type, ev.code);
-    auto it = eventcodes.find(code);
-    if (it == eventcodes.end()) return;
-    decodedevent decoded = it->second;
-    int id = decoded.first;
-    if (ev.type == EV_KEY) {
-      methods.send_value(ref, id, ev.value);
+  if (tag == &pipe_read) {
+    read_events(pipe_read);
+    return;
+  }
+  //Otherwise it is one of the event nodes we read directly.
+  int fd = (int)(intptr_t)tag;
+  if (read_events(fd) == ENODEV) {
+    //Stop watching it, or epoll would keep waking us up for it.
+    //The fd itself is closed once the generic manager hears about the removal.
+    methods.unwatch_file(ref, fd);
+  }
+}
+
+static inline bool test_bit(const uint8_t* bits, int bit) {
+  return bits[bit / 8] & (1 << (bit % 8));
+}
+
+//After events were dropped, read the current key and axis state straight from
+//the event nodes. send_value ignores unchanged values, so only differences go out.
+void generic_device::resync() {
+  uint8_t key_state[KEY_CNT / 8 + 1];
+  memset(key_state, 0, sizeof(key_state));
+  std::vector<int> fds = file->get_fds();
+  for (int fd : fds) {
+    uint8_t node_keys[KEY_CNT / 8 + 1];
+    memset(node_keys, 0, sizeof(node_keys));
+    if (ioctl(fd, EVIOCGKEY(sizeof(node_keys)), node_keys) < 0)
+      continue;
+    for (int i = 0; i < sizeof(key_state); i++)
+      key_state[i] |= node_keys[i];
+  }
+  for (int code = 0; code < KEY_CNT; code++) {
+    if (key_ids[code] >= 0)
+      methods.send_value(ref, key_ids[code], test_bit(key_state, code) ? 1 : 0);
+  }
+
+  for (int fd : fds) {
+    uint8_t abs_bits[ABS_CNT / 8 + 1];
+    memset(abs_bits, 0, sizeof(abs_bits));
+    if (ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits) < 0)
+      continue;
+    for (int code = 0; code < ABS_CNT; code++) {
+      if (axes[code].id < 0 || !test_bit(abs_bits, code))
+        continue;
+      input_absinfo info;
+      if (ioctl(fd, EVIOCGABS(code), &info) < 0)
+        continue;
+      methods.send_value(ref, axes[code].id, rescale_axis(axes[code], info.value));
     }
-    if (ev.type == EV_ABS) {
-      //do some ABS rescaling.
-      //currently ignoring old deadzone ("flat")
-      input_absinfo info = decoded.second;
-      int value = ev.value;
-      int64_t oldscale = info.maximum - info.minimum;
-      if (oldscale == 0) {
-        methods.send_value(ref, id, value);
-        return;
+  }
+
+  methods.send_syn_report(ref);
+}
+
+void generic_device::update_event_mask(int count, const unsigned char* wanted) {
+  std::vector<uint8_t> keys(KEY_CNT / 8 + 1, 0);
+  std::vector<uint8_t> abs(ABS_CNT / 8 + 1, 0);
+  for (int code = 0; code < KEY_CNT; code++) {
+    int id = key_ids[code];
+    if (id >= 0 && id < count && wanted[id])
+      keys[code / 8] |= 1 << (code % 8);
+  }
+  for (int code = 0; code < ABS_CNT; code++) {
+    int id = axes[code].id;
+    if (id >= 0 && id < count && wanted[id])
+      abs[code / 8] |= 1 << (code % 8);
+  }
+  file->set_event_mask(this, keys, abs);
+}
+
+//Returns the errno of a failed read, or 0. Sending events may clobber errno
+//itself, so callers should check this instead.
+int generic_device::read_events(int file) {
+  struct input_event evs[EVDEV_READ_BATCH];
+  int read_error = 0;
+  //Consecutive axis events are rescaled together before being sent.
+  int axis_codes[ABS_CNT];
+  int32_t axis_values[ABS_CNT];
+  int64_t axis_scaled[ABS_CNT];
+  int axis_count = 0;
+  auto send_axes = [&] () {
+    rescale_axes(axis_codes, axis_values, axis_scaled, axis_count);
+    for (int i = 0; i < axis_count; i++)
+      methods.send_value(ref, axes[axis_codes[i]].id, axis_scaled[i]);
+    axis_count = 0;
+  };
+
+  //Drain everything queued for us, many events per read().
+  ssize_t ret;
+  while ((ret = read(file, evs, sizeof(evs))) >= (ssize_t)sizeof(struct input_event)) {
+    int count = ret / sizeof(struct input_event);
+    for (int i = 0; i < count; i++) {
+      const input_event& ev = evs[i];
+      //The kernel dropped events: discard up to the end of the frame, then resync.
+      if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+        dropped = true;
+        axis_count = 0;
+        continue;
+      }
+      if (dropped) {
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+          dropped = false;
+          resync();
+        }
+        continue;
+      }
+      if (ev.type == EV_ABS) {
+        if (ev.code >= ABS_CNT || axes[ev.code].id < 0) continue;
+        axis_codes[axis_count] = ev.code;
+        axis_values[axis_count] = ev.value;
+        axis_count++;
+        if (axis_count == ABS_CNT)
+          send_axes();
+        continue;
+      }
+      //Keep the original order: axes before this event go out first.
+      if (axis_count)
+        send_axes();
+      if (ev.type == EV_SYN) {
+        methods.send_syn_report(ref);
+      }
+      if (ev.type == EV_KEY && ev.code < KEY_CNT) {
+        int id = key_ids[ev.code];
+        if (id >= 0)
+          methods.send_value(ref, id, ev.value);
       }
-      int64_t newscale = 2 * ABS_RANGE;
-      int64_t scaledvalue = -ABS_RANGE + (value - info.minimum) * newscale / oldscale;
-      methods.send_value(ref, id, scaledvalue);
     }
+    if (ret < sizeof(evs))
+      break; //Short read: nothing more is waiting right now.
   }
+  if (ret < 0)
+    read_error = errno;
+  if (axis_count)
+    send_axes();
+  return read_error;
 }
 
 int generic_device::upload_ff(ff_effect* effect) {
@@ -2,9 +2,10 @@
 #include <errno.h>
 
 
-generic_file::generic_file(moltengamepad* mg, struct udev_device* node, bool grab_ioctl, bool grab_chmod, bool rumble) {
+generic_file::generic_file(moltengamepad* mg, struct udev_device* node, bool grab_ioctl, bool grab_chmod, bool rumble, bool direct) {
   this->mg = mg;
   this->rumble = rumble;
+  this->direct = direct;
   struct udev_device* hidparent = udev_device_get_parent_with_subsystem_devtype(node,"hid",NULL);
   if (hidparent) {
     const char* uniq_id = udev_device_get_property_value(hidparent, "HID_UNIQ");
@@ -19,6 +20,14 @@ generic_file::generic_file(moltengamepad* mg, struct udev_device* node, bool gra
   this->grab_ioctl = grab_ioctl;
   this->grab_chmod = grab_chmod;
   open_node(node);
+
+  if (fds.empty()) throw - 1;
+
+  if (direct) {
+    internal_pipe[0] = internal_pipe[1] = -1;
+    return;
+  }
+
   //set up a pipe so we can talk to out own thread.
   pipe(internal_pipe);
   
@@ -28,8 +37,6 @@ generic_file::generic_file(moltengamepad* mg, struct udev_device* node, bool gra
   event.data.u32 = internal_pipe[0];
   int ret = epoll_ctl(epfd, EPOLL_CTL_ADD, internal_pipe[0], &event);
   if (ret < 0) perror("epoll add");
-  
-  if (fds.empty()) throw - 1;
 
   thread = new std::thread(&generic_file::thread_loop, this);
 }
@@ -53,8 +60,10 @@ generic_file::~generic_file() {
     mg->remove_device(dev.get());
   }
   close(epfd);
-  close(internal_pipe[0]);
-  close(internal_pipe[1]);
+  if (!direct) {
+    close(internal_pipe[0]);
+    close(internal_pipe[1]);
+  }
 
 }
 
@@ -79,6 +88,8 @@ void generic_file::open_node(struct udev_device* node) {
       ioctl(fd, EVIOCGRAB, 1);
     }
 
+    apply_event_masks(fd);
+
     if (grab_chmod) {
       //Remove all permissions. Other software will really ignore it.
       //Requires the device to be owned by the current user. (not merely have access)
@@ -86,13 +97,19 @@ void generic_file::open_node(struct udev_device* node) {
 
     }
 
-    struct epoll_event event;
-    memset(&event, 0, sizeof(event));
+    if (direct) {
+      //A node added later by flattening must be handed to the device as well.
+      if (direct_dev)
+        generic_device::methods.watch_file(direct_dev->ref, fd, generic_device::direct_tag(fd));
+    } else {
+      struct epoll_event event;
+      memset(&event, 0, sizeof(event));
 
-    event.events = EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP;
-    event.data.u32 = fd;
-    int ret = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
-    if (ret < 0) perror("epoll add");
+      event.events = EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP;
+      event.data.u32 = fd;
+      int ret = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+      if (ret < 0) perror("epoll add");
+    }
 
     fds.push_back(fd);
     nodes[path] = {path, udev_device_ref(node), fd};
@@ -120,15 +137,40 @@ void generic_file::close_node(const std::string& path, bool erase) {
 }
 
 void generic_file::add_dev(input_source* dev) {
+  std::lock_guard<std::mutex> guard(lock);
+  int index = devices.size();
   devices.push_back(dev->shared_from_this());
+  in_frame.push_back(false);
+  routed.emplace_back();
+  routed.back().reserve(EVDEV_READ_BATCH);
+
+  key_routes.resize(KEY_CNT, 0);
+  abs_routes.resize(ABS_CNT, 0);
+  if (index >= 64)
+    return;
+  generic_device* gendev = (generic_device*)dev->plug_data;
+  for (int code = 0; code < KEY_CNT; code++) {
+    if (gendev->key_ids[code] >= 0)
+      key_routes[code] |= (uint64_t)1 << index;
+  }
+  for (int code = 0; code < ABS_CNT; code++) {
+    if (gendev->axes[code].id >= 0)
+      abs_routes[code] |= (uint64_t)1 << index;
+  }
+}
+
+void generic_file::watch_direct(generic_device* dev) {
+  std::lock_guard<std::mutex> guard(lock);
+  direct_dev = dev;
+  for (auto& node_it : nodes)
+    generic_device::methods.watch_file(dev->ref, node_it.second.fd, generic_device::direct_tag(node_it.second.fd));
 }
 
 void generic_file::thread_loop() {
-  struct epoll_event event;
-  struct epoll_event events[1];
-  memset(&event, 0, sizeof(event));
+  struct epoll_event events[GENERIC_FILE_MAX_EVENTS];
+  memset(events, 0, sizeof(events));
   while ((keep_looping)) {
-    int n = epoll_wait(epfd, events, 1, -1);
+    int n = epoll_wait(epfd, events, GENERIC_FILE_MAX_EVENTS, -1);
     if (n < 0 && errno == EINTR) {
       continue;
     }
@@ -136,25 +178,151 @@ void generic_file::thread_loop() {
       perror("epoll wait:");
       break;
     }
-    if (n == 0) continue;
-    
-    struct input_event ev;
-    int file = events[0].data.u32;
-    int ret = read(file, &ev, sizeof(ev));
-    if (file == internal_pipe[0]) {
-      continue; //Just a quick ping to ensure we aren't stuck in epoll_wait
+
+    for (int i = 0; i < n && keep_looping; i++) {
+      int file = events[i].data.u32;
+      if (file == internal_pipe[0]) {
+        int beep;
+        read(file, &beep, sizeof(beep));
+        continue; //Just a quick ping to ensure we aren't stuck in epoll_wait
+      }
+      forward_events(file);
     }
-    if (ret == sizeof(ev)) {
-      for (auto dev : devices) {
-        write(((generic_device*)dev->plug_data)->pipe_write, &ev, sizeof(ev));
+  }
+}
+
+void generic_file::forward_events(int file) {
+  struct input_event evs[EVDEV_READ_BATCH];
+  //Read whole batches until the node is drained. Evdev only returns complete
+  //events, and each batch is written with one write() so the devices see the
+  //same events in the same order, frame boundaries included.
+  while (true) {
+    ssize_t ret = read(file, evs, sizeof(evs));
+    if (ret <= 0) {
+      if (ret < 0 && errno == ENODEV && keep_looping) {
+        close(file);
+        //TODO: possibly close out the stored node as well?
+        //For now, rely on the generic manager telling us via udev events.
       }
-    } else if (errno == ENODEV && keep_looping) {
-      close(file);
-      //TODO: possibly close out the stored node as well?
-      //For now, rely on the generic manager telling us via udev events.
+      return;
     }
+    route_events(evs, ret / sizeof(struct input_event));
+    if (ret < sizeof(evs))
+      return; //Short read: nothing more is waiting right now.
+  }
+}
+
+//Give each split device only the events for codes it registered.
+//A SYN_REPORT goes only to devices that were sent something in that frame.
+void generic_file::route_events(const input_event* evs, int count) {
+  int num_devs;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    num_devs = devices.size();
+    for (int i = 0; i < count; i++) {
+      const input_event& ev = evs[i];
+      uint64_t targets = 0;
+      if (ev.type == EV_KEY && ev.code < KEY_CNT)
+        targets = key_routes[ev.code];
+      else if (ev.type == EV_ABS && ev.code < ABS_CNT)
+        targets = abs_routes[ev.code];
+      else if (ev.type != EV_SYN)
+        continue; //No generic device reads any other event type.
+
+      for (int d = 0; d < num_devs; d++) {
+        if (ev.type == EV_SYN) {
+          //Everyone sees a SYN_DROPPED, and so also the SYN_REPORT that ends it.
+          //Other SYN codes only go where the frame went, and don't end it.
+          if (ev.code == SYN_DROPPED)
+            in_frame[d] = true;
+          else if (!in_frame[d])
+            continue;
+          else if (ev.code == SYN_REPORT)
+            in_frame[d] = false;
+        } else if (d < 64 && !(targets & ((uint64_t)1 << d))) {
+          continue;
+        } else {
+          in_frame[d] = true;
+        }
+        routed[d].push_back(ev);
+      }
+    }
+    //add_dev may grow routed once we let go, so take the events out with us.
+    outgoing.resize(num_devs);
+    outgoing_fds.resize(num_devs);
+    for (int d = 0; d < num_devs; d++) {
+      outgoing[d].swap(routed[d]);
+      outgoing_fds[d] = ((generic_device*)devices[d]->plug_data)->pipe_write;
+    }
+  }
+
+  //Write without the lock: a device thread takes it too (resync, event masks),
+  //so blocking on a full pipe while holding it could hang us both.
+  //Devices are only dropped once this thread has stopped, so the fds stay valid.
+  for (int d = 0; d < num_devs; d++) {
+    if (outgoing[d].empty()) continue;
+    write(outgoing_fds[d], outgoing[d].data(), outgoing[d].size() * sizeof(input_event));
+    outgoing[d].clear();
+  }
+}
+
+void generic_file::set_event_mask(generic_device* dev, std::vector<uint8_t>& key_mask, std::vector<uint8_t>& abs_mask) {
+  std::lock_guard<std::mutex> guard(lock);
+  dev->key_mask.swap(key_mask);
+  dev->abs_mask.swap(abs_mask);
+  dev->has_mask = true;
+  for (auto& node_it : nodes)
+    apply_event_masks(node_it.second.fd);
+}
 
+//Have the kernel only send events that some device of ours still cares about.
+//Called with lock held.
+void generic_file::apply_event_masks(int fd) {
+#ifdef EVIOCSMASK
+  std::vector<uint8_t> keys(KEY_CNT / 8 + 1, 0);
+  std::vector<uint8_t> abs(ABS_CNT / 8 + 1, 0);
+  for (auto dev : devices) {
+    generic_device* gendev = (generic_device*)dev->plug_data;
+    //Until every device has reported in, leave everything unmasked.
+    if (!gendev->has_mask)
+      return;
+    for (int i = 0; i < keys.size(); i++)
+      keys[i] |= gendev->key_mask[i];
+    for (int i = 0; i < abs.size(); i++)
+      abs[i] |= gendev->abs_mask[i];
   }
+  if (devices.empty())
+    return;
+  //No generic device reads these types at all.
+  std::vector<uint8_t> none(REL_CNT / 8 + 1 > MSC_CNT / 8 + 1 ? REL_CNT / 8 + 1 : MSC_CNT / 8 + 1, 0);
+
+  struct input_mask mask;
+  mask.type = EV_KEY;
+  mask.codes_size = keys.size();
+  mask.codes_ptr = (uint64_t)(uintptr_t)keys.data();
+  //Older kernels lack EVIOCSMASK; they just keep sending everything.
+  if (ioctl(fd, EVIOCSMASK, &mask) < 0)
+    return;
+  mask.type = EV_ABS;
+  mask.codes_size = abs.size();
+  mask.codes_ptr = (uint64_t)(uintptr_t)abs.data();
+  ioctl(fd, EVIOCSMASK, &mask);
+  mask.type = EV_REL;
+  mask.codes_size = REL_CNT / 8 + 1;
+  mask.codes_ptr = (uint64_t)(uintptr_t)none.data();
+  ioctl(fd, EVIOCSMASK, &mask);
+  mask.type = EV_MSC;
+  mask.codes_size = MSC_CNT / 8 + 1;
+  ioctl(fd, EVIOCSMASK, &mask);
+#endif
+}
+
+std::vector<int> generic_file::get_fds() {
+  std::lock_guard<std::mutex> guard(lock);
+  std::vector<int> open_fds;
+  for (auto& node_it : nodes)
+    open_fds.push_back(node_it.second.fd);
+  return open_fds;
 }
 
 int generic_file::get_fd() {
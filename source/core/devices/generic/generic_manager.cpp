@@ -1,9 +1,11 @@
 #include "generic.h"
 #include <algorithm>
 #include <unordered_map>
-#include <set>
+#include <bitset>
+#include <memory>
 
 manager_methods generic_manager::methods;
+generic_match_index generic_manager::match_index;
 
 generic_manager::generic_manager(moltengamepad* mg, generic_driver_info& descr) : mg(mg) {
   this->devname = descr.devname.c_str();
@@ -19,6 +21,16 @@ generic_manager::generic_manager(moltengamepad* mg, generic_driver_info& descr)
   for (int i = 1; i <= split; i++) {
     splitevents.push_back(std::vector<split_ev_info>());
   }
+
+  //Collect the events the config lists, for matching against device capabilities.
+  for (const gen_source_event& g_ev : descr.events) {
+    if (g_ev.type == DEV_KEY && g_ev.code >= 0 && g_ev.code < KEY_CNT)
+      driver_events.key.set(g_ev.code);
+    else if (g_ev.type == DEV_AXIS && g_ev.code >= 0 && g_ev.code < ABS_CNT)
+      driver_events.abs.set(g_ev.code);
+    else
+      other_events = true;
+  }
 }
 
 int generic_manager::init(device_manager* ref) {
@@ -46,6 +58,8 @@ int generic_manager::init(device_manager* ref) {
   }
 
   descr->split_types.resize(split,"gamepad");
+
+  match_index.add(this);
   
 
 }
@@ -65,6 +79,7 @@ manager_plugin generic_manager::get_plugin() {
 }
 
 generic_manager::~generic_manager() {
+  match_index.remove(this);
 
   for (auto file : openfiles) {
     delete file;
@@ -78,18 +93,17 @@ generic_manager::~generic_manager() {
 #define WORD_SIZE sizeof(size_t)*8
 #endif
 
-std::vector<int> read_capabilities(const char* capabilities) {
-  std::vector<int> codes;
+template <size_t N>
+void read_capabilities(const char* capabilities, std::bitset<N>& bits) {
   int len = strlen(capabilities);
   if (len <= 0)
-    return codes;
+    return;
   //We are given a bitmask in hexadecimal
   //We read right to left, as the lowest codes have the last bits.
   //When we encounter a space, we skip to the next word boundary.
   //(Any leading zeroes in a word have been stripped!)
   int code = 0;
   int next_word = WORD_SIZE;
-  const char* ptr = capabilities + len - 1;
 
   for (const char* ptr = capabilities + len; ptr >= capabilities; ptr--) {
     if (*ptr == '\n' || *ptr == '\0')
@@ -107,89 +121,138 @@ std::vector<int> read_capabilities(const char* capabilities) {
     if (digit >= 'a' && digit <= 'f')
       digit = (digit - 'a') + 10;
     for (int i = 0;  i < 4; i++) {
-      if (digit & 1) {
-        codes.push_back(code);
+      if ((digit & 1) && code < (int)N) {
+        bits.set(code);
       }
       digit >>= 1;
       code++;
     }
   }
-  return codes;
 }
 
+template <size_t N>
+int lowest_bit(const std::bitset<N>& bits) {
+  for (size_t i = 0; i < N; i++)
+    if (bits.test(i)) return i;
+  return -1;
+}
 
-bool events_matched(udev* udev, udev_device* dev, const generic_driver_info* gendev, device_match::ev_match match) {
-  if (match == device_match::EV_MATCH_IGNORED)
-    return true;
-  std::set<std::pair<entry_type,int>> gendev_events;
-  bool superset = false;
-  bool subset = true;
-  char* buffer = new char[1024];
-  memset(buffer, 0, 1024);
-  //only used to report why a match failed;
-  int superkey = -1; //a key that is evidence of a superset
-  int superabs = -1; //an abs that is evidence of a superset
-  for (const gen_source_event& g_ev : gendev->events)
-    gendev_events.insert(std::make_pair(g_ev.type,g_ev.code));
-
-  udev_device* parent = udev_device_get_parent(dev);
-  const char* syspath = udev_device_get_syspath(parent);
-  if (!syspath) {
-    delete[] buffer;
-    return false;
-  }
-  std::string base_path(syspath);
-  base_path += "/capabilities/";
-  //Check abs events
-  int fd = open((base_path+"abs").c_str(), O_RDONLY);
-  if (fd < 1) {
-    delete[] buffer;
-    return false;
+template <size_t N>
+int highest_bit(const std::bitset<N>& bits) {
+  for (size_t i = N; i > 0; i--)
+    if (bits.test(i-1)) return i-1;
+  return -1;
+}
+
+//Parsed capabilities, keyed by the syspath of the parent input device.
+//Every gendev manager checks every event node, often with several match lines,
+//so this saves reading and parsing the same sysfs files over and over.
+//The kernel never reuses inputN names, so entries cannot go stale.
+std::unordered_map<std::string, std::shared_ptr<const ev_capabilities>> capability_cache;
+std::mutex capability_cache_lock;
+
+std::shared_ptr<const ev_capabilities> load_capabilities(udev_device* parent) {
+  const char* syspath = parent ? udev_device_get_syspath(parent) : nullptr;
+  if (!syspath)
+    return nullptr;
+  std::lock_guard<std::mutex> guard(capability_cache_lock);
+  auto it = capability_cache.find(syspath);
+  if (it != capability_cache.end())
+    return it->second;
+
+  //Read through libudev, which may already have these from startup enumeration.
+  //Failures are not cached, sysfs might just not be ready yet.
+  const char* abs = udev_device_get_sysattr_value(parent, "capabilities/abs");
+  const char* key = udev_device_get_sysattr_value(parent, "capabilities/key");
+  if (!abs || !key)
+    return nullptr;
+  auto caps = std::make_shared<ev_capabilities>();
+  read_capabilities(abs, caps->abs);
+  read_capabilities(key, caps->key);
+
+  capability_cache[syspath] = caps;
+  return caps;
+}
+
+//Called on removal of either the input device or one of its event nodes.
+void forget_capabilities(const char* syspath) {
+  std::string path(syspath);
+  std::lock_guard<std::mutex> guard(capability_cache_lock);
+  capability_cache.erase(path);
+  size_t slash = path.rfind('/');
+  if (slash != std::string::npos)
+    capability_cache.erase(path.substr(0, slash));
+}
+
+void gather_match_info(udev_device* dev, udev_match_info& info) {
+  struct udev_device* hidparent = udev_device_get_parent_with_subsystem_devtype(dev,"hid",NULL);
+  info.parent = udev_device_get_parent(dev);
+  if (hidparent) {
+    info.phys = udev_device_get_property_value(hidparent, "HID_PHYS");
+    info.uniq = udev_device_get_property_value(hidparent, "HID_UNIQ");
   }
-  read(fd, buffer, 1024);
-  buffer[1023] = '\0';
-  close(fd);
-  std::vector<int> codes = read_capabilities(buffer);
-  for (int code : codes) {
-    std::pair<entry_type,int> pair = std::make_pair(DEV_AXIS,code);
-    int found = gendev_events.erase(pair);
-    if (!found) {
-      subset = false;
-      superabs = code;
-    }
+  std::string vendor_id;
+  std::string product_id;
+  if (info.parent) {
+    info.name = udev_device_get_sysattr_value(info.parent, "name");
+    const char* productstring = udev_device_get_property_value(info.parent, "PRODUCT");
+    std::string ids = "";
+    if (productstring) ids = std::string(productstring);
+    std::stringstream stream(ids);
+    std::string bus;
+    std::getline(stream, bus, '/');
+    std::getline(stream, vendor_id, '/');
+    std::getline(stream, product_id, '/');
   }
-  int total_events = codes.size();
-  //check key events
-  fd = open((base_path+"key").c_str(), O_RDONLY);
-  if (fd < 1) {
-    delete[] buffer;
-    return false;
+  info.vendor = parse_hex(vendor_id);
+  info.product = parse_hex(product_id);
+  info.driver = udev_device_get_driver(dev);
+  udev_device* driver_parent = info.parent;
+  while (info.driver == nullptr && driver_parent) {
+    info.driver = udev_device_get_driver(driver_parent);
+    driver_parent = udev_device_get_parent(driver_parent);
   }
-  memset(buffer, 0, 1024);
-  read(fd, buffer, 1024);
-  buffer[1023] = '\0';
-  close(fd);
-  codes = read_capabilities(buffer);
-  for (int code : codes) {
-    std::pair<entry_type,int> pair = std::make_pair(DEV_KEY,code);
-    int found = gendev_events.erase(pair);
-    if (!found) {
-      subset = false;
-      superkey = code;
-    }
+}
+
+bool events_matched(udev_match_info& info, const ev_capabilities& wanted, bool other_events, device_match::ev_match match) {
+  if (match == device_match::EV_MATCH_IGNORED)
+    return true;
+  if (!info.caps_loaded) {
+    info.caps = load_capabilities(info.parent);
+    info.caps_loaded = true;
   }
-  total_events += codes.size();
-  delete[] buffer;
-  superset = gendev_events.empty();
-  
+  if (!info.caps)
+    return false;
+  const ev_capabilities& caps = *info.caps;
+
+  std::bitset<KEY_CNT> extra_keys = caps.key & ~wanted.key;
+  std::bitset<ABS_CNT> extra_abs = caps.abs & ~wanted.abs;
+  std::bitset<KEY_CNT> missing_keys = wanted.key & ~caps.key;
+  std::bitset<ABS_CNT> missing_abs = wanted.abs & ~caps.abs;
+  bool subset = extra_keys.none() && extra_abs.none();
+  bool superset = missing_keys.none() && missing_abs.none() && !other_events;
+  size_t total_events = caps.key.count() + caps.abs.count();
+
+  //only used to report why a match failed;
+  auto report_extra = [&] (const char* check) {
+    if (extra_keys.any())
+      debug_print(DEBUG_VERBOSE, 3, check, " failed because device had key ", std::to_string(highest_bit(extra_keys)).c_str());
+    else if (extra_abs.any())
+      debug_print(DEBUG_VERBOSE, 3, check, " failed because device had abs ", std::to_string(highest_bit(extra_abs)).c_str());
+  };
+  auto report_missing = [&] (const char* check) {
+    if (missing_keys.any())
+      debug_print(DEBUG_VERBOSE, 3, check, " failed because device was missing key ", std::to_string(lowest_bit(missing_keys)).c_str());
+    else if (missing_abs.any())
+      debug_print(DEBUG_VERBOSE, 3, check, " failed because device was missing abs ", std::to_string(lowest_bit(missing_abs)).c_str());
+    else
+      debug_print(DEBUG_VERBOSE, 2, check, " failed because the driver lists events that are neither key nor abs");
+  };
+
   if (match == device_match::EV_MATCH_SUBSET) {
     //reject the empty set as a trivial subset.
-    if (!subset) {
-      if (superkey != -1)
-        debug_print(DEBUG_VERBOSE, 2, "\t\t events subset: failed because device had key ", std::to_string(superkey).c_str());
-      else if (superabs != -1)
-        debug_print(DEBUG_VERBOSE, 2, "\t\t events subset: failed because device had abs ", std::to_string(superabs).c_str());
-    }
+    if (!subset)
+      report_extra("\t\t events subset:");
     if (total_events == 0)
       debug_print(DEBUG_VERBOSE, 2, "\t\t events subset: failed because device had no detected events");
     subset = subset && (total_events > 0);
@@ -200,15 +263,11 @@ bool events_matched(udev* udev, udev_device* dev, const generic_driver_info* gen
   if (match == device_match::EV_MATCH_EXACT) {
     //check for both superset and subset.
     if (!subset) {
-      if (superkey != -1)
-        debug_print(DEBUG_VERBOSE, 2, "\t\t events exact: failed because device had key ", std::to_string(superkey).c_str());
-      else if (superabs != -1)
-        debug_print(DEBUG_VERBOSE, 2, "\t\t events exact: failed because device had abs ", std::to_string(superabs).c_str());
+      report_extra("\t\t events exact:");
       return false;
     }
     if (!superset) {
-      const char* types[] = {"none","opt","key","abs","rel","any"};
-      debug_print(DEBUG_VERBOSE, 4, "\t\t events exact: failed because device was missing ", types[gendev_events.begin()->first], " ", std::to_string(gendev_events.begin()->second).c_str());
+      report_missing("\t\t events exact:");
       return false;
     }
     debug_print(DEBUG_VERBOSE, 1, "\t\t events exact: check passed");
@@ -216,8 +275,7 @@ bool events_matched(udev* udev, udev_device* dev, const generic_driver_info* gen
   }
   if (match == device_match::EV_MATCH_SUPERSET) {
     if (!superset) {
-      const char* types[] = {"none","opt","key","abs","rel","any"};
-      debug_print(DEBUG_VERBOSE, 4, "\t\t events superset: failed because device was missing ", types[gendev_events.begin()->first], " ", std::to_string(gendev_events.begin()->second).c_str());
+      report_missing("\t\t events superset:");
       return false;
     }
     debug_print(DEBUG_VERBOSE, 1, "\t\t events superset: check passed");
@@ -226,88 +284,136 @@ bool events_matched(udev* udev, udev_device* dev, const generic_driver_info* gen
   return false;
 }
 
-bool matched(struct udev* udev, struct udev_device* dev, const device_match& match, const generic_driver_info* gendev) {
+bool matched(udev_match_info& info, const device_match& match, const ev_capabilities& driver_events, bool other_events) {
   bool result = true;
   bool valid = false; //require at least one thing be matched...
-  //lots of things to compute
-  const char* phys = nullptr;
-  const char* uniq = nullptr;
-  const char* driver = udev_device_get_driver(dev);
-  std::string vendor_id;
-  std::string product_id;
-  struct udev_device* hidparent = udev_device_get_parent_with_subsystem_devtype(dev,"hid",NULL);
-  struct udev_device* parent = udev_device_get_parent(dev);
-  if (hidparent) {
-    phys = udev_device_get_property_value(hidparent, "HID_PHYS");
-    uniq = udev_device_get_property_value(hidparent, "HID_UNIQ");
-  }
-  //only bother parsing this string if we will later match it
-  if (parent && (match.vendor != -1 || match.product != -1) ) {
-    const char* productstring = udev_device_get_property_value(parent, "PRODUCT");
-    std::string ids = "";
-    if (productstring) ids = std::string(productstring);
-    std::stringstream stream(ids);
-    std::string bus;
-    std::getline(stream, bus, '/');
-    std::getline(stream, vendor_id, '/');
-    std::getline(stream, product_id, '/');
-  }
   //start checking matches.
   //result is true if ALL criteria are met
   //valid is true if AT LEAST ONE criteria is valid
   debug_print(DEBUG_VERBOSE, 1, "\t\tchecking match line...");
   if (!match.name.empty()) {
     valid = true;
-    const char* name = nullptr;
-    name = udev_device_get_sysattr_value(parent, "name");
-    bool check = (name && !strcmp(match.name.c_str(), name));
+    bool check = (info.name && !strcmp(match.name.c_str(), info.name));
     result = result && check;
-    debug_print(DEBUG_VERBOSE, 4, "\t\t name: ", name ?  name : "", check ? " == " : " != ", match.name.c_str());
+    debug_print(DEBUG_VERBOSE, 4, "\t\t name: ", info.name ?  info.name : "", check ? " == " : " != ", match.name.c_str());
   }
   if (!match.uniq.empty()) {
     valid = true;
-    bool check = (uniq && !strcmp(match.uniq.c_str(), uniq));
-    debug_print(DEBUG_VERBOSE, 4, "\t\t uniq: ", uniq ?  uniq : "", check ? " == " : " != ", match.uniq.c_str());
+    bool check = (info.uniq && !strcmp(match.uniq.c_str(), info.uniq));
+    debug_print(DEBUG_VERBOSE, 4, "\t\t uniq: ", info.uniq ?  info.uniq : "", check ? " == " : " != ", match.uniq.c_str());
   }
   if (!match.phys.empty()) {
     valid = true;
-    bool check = (phys && !strcmp(match.phys.c_str(), phys));
+    bool check = (info.phys && !strcmp(match.phys.c_str(), info.phys));
     result = result && check;
-    debug_print(DEBUG_VERBOSE, 4, "\t\t phys: ", phys ?  phys : "", check ? " == " : " != ", match.phys.c_str());
+    debug_print(DEBUG_VERBOSE, 4, "\t\t phys: ", info.phys ?  info.phys : "", check ? " == " : " != ", match.phys.c_str());
   }
   if (!match.driver.empty()) {
     valid = true;
-    udev_device* driver_parent = parent;
-    while (driver == nullptr && driver_parent) {
-      driver = udev_device_get_driver(driver_parent);
-      driver_parent = udev_device_get_parent(driver_parent);
-    }
-    bool check = (driver && !strcmp(match.driver.c_str(), driver));
+    bool check = (info.driver && !strcmp(match.driver.c_str(), info.driver));
     result = result && check;
-    debug_print(DEBUG_VERBOSE, 4, "\t\t driver: ", driver ?  driver : "", check ? " == " : " != ", match.driver.c_str());
+    debug_print(DEBUG_VERBOSE, 4, "\t\t driver: ", info.driver ?  info.driver : "", check ? " == " : " != ", match.driver.c_str());
   }
   if (match.vendor != -1) {
     valid = true;
-    int vendor = parse_hex(vendor_id);
-    bool check = (match.vendor == vendor);
+    bool check = (match.vendor == info.vendor);
     result = result && check;
-    debug_print(DEBUG_VERBOSE, 4, "\t\t vendor: ",   std::to_string(vendor).c_str(), check ? " == " : " != ", std::to_string(match.vendor).c_str());
+    debug_print(DEBUG_VERBOSE, 4, "\t\t vendor: ",   std::to_string(info.vendor).c_str(), check ? " == " : " != ", std::to_string(match.vendor).c_str());
   }
   if (match.product != -1) {
     valid = true;
-    int product = parse_hex(product_id);
-    bool check = (match.product == product);
+    bool check = (match.product == info.product);
     result = result && check;
-    debug_print(DEBUG_VERBOSE, 4, "\t\t product: ",   std::to_string(product).c_str(), check ? " == " : " != ", std::to_string(match.product).c_str());
+    debug_print(DEBUG_VERBOSE, 4, "\t\t product: ",   std::to_string(info.product).c_str(), check ? " == " : " != ", std::to_string(match.product).c_str());
   }
   if (match.events != device_match::EV_MATCH_IGNORED) {
     valid = true;
-    result = result && events_matched(udev, dev, gendev, match.events);
+    result = result && events_matched(info, driver_events, other_events, match.events);
   }
   //a match must be valid as well as meeting all criteria
   return valid && result;
 }
 
+void generic_match_index::add(generic_manager* manager) {
+  std::lock_guard<std::mutex> guard(lock);
+  forget_last();
+  int position = 0;
+  for (const device_match& match : manager->descr->matches) {
+    entry ent = {manager, &match, position++};
+    if (match.vendor != -1 && match.product != -1)
+      by_ids[((uint64_t)(uint32_t)match.vendor << 32) | (uint32_t)match.product].push_back(ent);
+    else if (match.vendor != -1)
+      by_vendor[match.vendor].push_back(ent);
+    else if (!match.name.empty())
+      by_name[match.name].push_back(ent);
+    else
+      residual.push_back(ent);
+  }
+}
+
+void generic_match_index::remove(generic_manager* manager) {
+  std::lock_guard<std::mutex> guard(lock);
+  forget_last();
+  auto drop = [manager] (std::vector<entry>& list) {
+    list.erase(std::remove_if(list.begin(), list.end(), [manager] (const entry& ent) {
+      return ent.manager == manager;
+    }), list.end());
+  };
+  for (auto& it : by_ids)
+    drop(it.second);
+  for (auto& it : by_vendor)
+    drop(it.second);
+  for (auto& it : by_name)
+    drop(it.second);
+  drop(residual);
+}
+
+void generic_match_index::forget_last() {
+  if (last_dev)
+    udev_device_unref(last_dev);
+  last_dev = nullptr;
+  last_info = udev_match_info();
+  last_candidates.clear();
+}
+
+std::vector<const device_match*> generic_match_index::candidates(udev_device* dev, generic_manager* manager, udev_match_info& info) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (dev != last_dev) {
+    forget_last();
+    last_dev = udev_device_ref(dev);
+    gather_match_info(dev, last_info);
+
+    std::vector<entry> found(residual);
+    if (last_info.vendor != -1) {
+      auto it = by_ids.find(((uint64_t)(uint32_t)last_info.vendor << 32) | (uint32_t)last_info.product);
+      if (it != by_ids.end())
+        found.insert(found.end(), it->second.begin(), it->second.end());
+      auto vit = by_vendor.find(last_info.vendor);
+      if (vit != by_vendor.end())
+        found.insert(found.end(), vit->second.begin(), vit->second.end());
+    }
+    if (last_info.name) {
+      auto it = by_name.find(last_info.name);
+      if (it != by_name.end())
+        found.insert(found.end(), it->second.begin(), it->second.end());
+    }
+    //Immediate claims first, so a successful one skips the deferred lines.
+    std::sort(found.begin(), found.end(), [] (const entry& a, const entry& b) {
+      if (a.match->order != b.match->order)
+        return a.match->order < b.match->order;
+      return a.position < b.position;
+    });
+    for (const entry& ent : found)
+      last_candidates[ent.manager].push_back(ent.match);
+  }
+
+  info = last_info;
+  auto it = last_candidates.find(manager);
+  if (it == last_candidates.end())
+    return std::vector<const device_match*>();
+  return it->second;
+}
+
 int generic_manager::accept_device(struct udev* udev, struct udev_device* dev) {
   std::lock_guard<std::mutex> lock(devlistlock);
   const char* path = udev_device_get_syspath(dev);
@@ -317,6 +423,7 @@ int generic_manager::accept_device(struct udev* udev, struct udev_device* dev) {
 
   if (!strcmp(action, "remove")) {
     if (!path) return DEVICE_UNCLAIMED;
+    forget_capabilities(path);
     for (auto it = openfiles.begin(); it != openfiles.end(); it++) {
       (*it)->close_node(dev, true);
       if ((*it)->nodes.empty()) {
@@ -333,8 +440,12 @@ int generic_manager::accept_device(struct udev* udev, struct udev_device* dev) {
       const char* sysname = udev_device_get_sysname(dev);
       const char* name = nullptr;
       if (!strncmp(sysname, "event", 3)) {
-        for (auto it = descr->matches.begin(); it != descr->matches.end(); it++) {
-          if (matched(udev,dev,*it, descr)) {
+        udev_match_info info;
+        std::vector<const device_match*> lines = match_index.candidates(dev, this, info);
+        if (lines.empty())
+          debug_print(DEBUG_VERBOSE, 1, "\t\tno match lines apply");
+        for (const device_match* it : lines) {
+          if (matched(info, *it, driver_events, other_events)) {
             debug_print(DEBUG_VERBOSE,2, "\t\t match passed", it->order > 0 ? (", order = " + std::to_string(it->order+1)).c_str() : "");
             //If we are claiming this, open the device and return DEVICE_CLAIMED.
             if (it->order == DEVICE_CLAIMED && open_device(udev, dev) == SUCCESS)
@@ -375,7 +486,9 @@ int generic_manager::open_device(struct udev* udev, struct udev_device* dev) {
     if (flatten && openfiles.size() >= 1) {
       openfiles.front()->open_node(dev);
     } else {
-      openfiles.push_back(new generic_file(mg, dev, descr->grab_ioctl, descr->grab_chmod, descr->rumble));
+      //With a single split, the lone device can just read the event nodes itself.
+      bool direct = split == 1 && mg->opts->get<bool>("gendev_direct_read");
+      openfiles.push_back(new generic_file(mg, dev, descr->grab_ioctl, descr->grab_chmod, descr->rumble, direct));
       create_inputs(openfiles.back());
     }
   } catch (...) {
@@ -446,5 +446,9 @@ int init_generic_callbacks() {
   genericdev.play_ff =  [] (void* ref, int id, int repetitions) {
     return ((generic_device*)ref)->play_ff(id, repetitions);
   };
+  genericdev.update_event_mask = [] (void* ref, int count, const unsigned char* wanted) {
+    ((generic_device*)ref)->update_event_mask(count, wanted);
+    return 0;
+  };
 }
 
@@ -3,12 +3,77 @@
 #include <sys/epoll.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <algorithm>
 #include <thread>
 #include <iostream>
+#include <atomic>
+#include <cstddef>
+#include <typeinfo>
+#include "../mpsc_queue.h"
+#include "../event_engine.h"
+
+//Upper bound on the device_batch_size option.
+#define MAX_BATCH_SIZE 64
+
+struct input_internal_msg {
+  enum input_msg_type { IN_TRANS_MSG, IN_ADV_TRANS_MSG, IN_EVENT_MSG, IN_OPTION_MSG, IN_SLOT_MSG, IN_END_THREAD_MSG } type;
+  int id;
+  int64_t value;
+  MGField field;
+  adv_entry adv;
+  bool skip_adv_trans;
+  char* name;
+};
+
+
+//How many internal messages can be queued before spilling into the overflow list.
+#define INTERNAL_QUEUE_SIZE 256
+
+//Messages from other threads to a device thread.
+//Posting never blocks: if the lock-free ring is full, messages spill
+//into a locked overflow list that is drained after the ring.
+struct input_msg_queue {
+  mpsc_queue<input_internal_msg> ring;
+  int doorbell; //eventfd, written only when the consumer might be asleep.
+  std::atomic<bool> rung;
+  std::atomic<bool> overflowing;
+  std::mutex overflow_lock;
+  std::vector<input_internal_msg> overflow;
+
+  input_msg_queue() : ring(INTERNAL_QUEUE_SIZE), rung(false), overflowing(false) {
+    doorbell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (doorbell < 0) perror("eventfd");
+  }
+
+  ~input_msg_queue() {
+    close(doorbell);
+  }
+
+  void post(const input_internal_msg& msg) {
+    //Once anything has spilled, keep spilling to preserve message order.
+    bool queued = !overflowing && ring.push(msg);
+    if (!queued) {
+      std::lock_guard<std::mutex> guard(overflow_lock);
+      overflow.push_back(msg);
+      overflowing = true;
+    }
+    //Only the first message since the last drain needs to wake the consumer.
+    if (!rung.exchange(true)) {
+      uint64_t one = 1;
+      write(doorbell, &one, sizeof(one));
+    }
+  }
+};
 
 input_source::input_source(device_manager* manager, device_plugin plugin, void* plug_data) 
       : manager(manager), plugin(plugin), plug_data(plug_data), uniq(plugin.uniq), phys(plugin.phys) {
 
+  //Plugins built against an older device_plugin don't have the later callbacks.
+  if (plugin.size < offsetof(device_plugin, update_event_mask) + sizeof(plugin.update_event_mask))
+    this->plugin.update_event_mask = nullptr;
+
   for (auto ev : manager->get_events())
     register_event(ev);
   std::vector<option_info> prof_opts;
@@ -19,24 +84,31 @@ input_source::input_source(device_manager* manager, device_plugin plugin, void*
   epfd = epoll_create(1);
   if (epfd < 1) perror("epoll create");
 
-  int internal[2];
-  pipe(internal);
-  watch_file(internal[0], this);
+  msg_queue = new input_msg_queue();
+  watch_file(msg_queue->doorbell, this);
+
+  recurring_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (recurring_timer < 0)
+    perror("timerfd");
+  else
+    watch_file(recurring_timer, &recurring_timer);
 
-  priv_pipe = internal[1];
-  internalpipe = internal[0];
-  
   if (plugin.init)
     plugin.init(plug_data, this);
 
   ff_ids[0] = -1;
+
+  batch_size = manager->mg->opts->get<int>("device_batch_size");
+  if (batch_size < 1) batch_size = 1;
+  if (batch_size > MAX_BATCH_SIZE) batch_size = MAX_BATCH_SIZE;
 }
   
 
 input_source::~input_source() {
   end_thread();
-  close(internalpipe);
-  close(priv_pipe);
+  delete msg_queue;
+  if (recurring_timer >= 0)
+    close(recurring_timer);
   close(epfd);
   for (int i = 0; i < ev_map.size(); i++) {
     if (ev_map[i].trans) delete ev_map[i].trans;
@@ -57,17 +129,6 @@ input_source::~input_source() {
     plugin.destroy(plug_data);
 }
 
-struct input_internal_msg {
-  enum input_msg_type { IN_TRANS_MSG, IN_ADV_TRANS_MSG, IN_EVENT_MSG, IN_OPTION_MSG, IN_SLOT_MSG, IN_END_THREAD_MSG } type;
-  int id;
-  int64_t value;
-  MGField field;
-  adv_entry adv;
-  bool skip_adv_trans;
-  char* name;
-};
-
-
 void input_source::register_event(event_decl ev) {
   int id = events.size();
   source_event event = {
@@ -80,6 +141,9 @@ void input_source::register_event(event_decl ev) {
   };
   events.push_back(event);
   ev_map.resize(events.size());
+  listener_start.push_back(listeners.size());
+  listener_bits.resize((events.size() + 63) / 64, 0);
+  program_dirty = true;
 }
 
 void input_source::toggle_event(int id, event_state state) {
@@ -88,6 +152,8 @@ void input_source::toggle_event(int id, event_state state) {
   events[id].state = state;
   if (state == EVENT_DISABLED)
     devprofile->remove_event(std::string(events[id].name));
+  //Applied once the pending internal messages have been handled.
+  event_mask_dirty = true;
 }
 
 void input_source::register_option(option_info opt) {
@@ -112,6 +178,12 @@ void input_source::watch_file(int fd, void* tag) {
   if (ret < 0) perror("epoll add");
 }
 
+void input_source::unwatch_file(int fd) {
+  if (fd <= 0) return;
+  int ret = epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+  if (ret < 0) perror("epoll del");
+}
+
 
 void input_source::update_map(const char* evname, event_translator* trans) {
   std::string name(evname);
@@ -145,14 +217,13 @@ char* copy_str(const char* str) {
 }
 
 void input_source::update_option(const char* name, const MGField value) {
-  struct input_internal_msg msg;
-  memset(&msg, 0, sizeof(msg));
+  struct input_internal_msg msg = {};
   msg.field = value;
   msg.name = copy_str(name);
   if (value.type == MG_STRING)
     msg.field.string = copy_str(value.string);
   msg.type = input_internal_msg::IN_OPTION_MSG;
-  write(priv_pipe, &msg, sizeof(msg));
+  msg_queue->post(msg);
 }
 
 void input_source::set_slot(output_slot* slot) {
@@ -167,11 +238,10 @@ void input_source::set_slot(output_slot* slot) {
   }
   if (slot)
     slot->add_device(shared_from_this());
-  struct input_internal_msg msg;
-  memset(&msg, 0, sizeof(msg));
+  struct input_internal_msg msg = {};
   msg.field.slot = slot;
   msg.type = input_internal_msg::IN_SLOT_MSG;
-  write(priv_pipe, &msg, sizeof(msg));
+  msg_queue->post(msg);
   assigned_slot = slot;
 }
 
@@ -187,8 +257,7 @@ void input_source::list_options(std::vector<option_info>& list) const {
 
 
 void input_source::update_advanced(const std::vector<std::string>& evnames, advanced_event_translator* trans) {
-  struct input_internal_msg msg;
-  memset(&msg, 0, sizeof(msg));
+  struct input_internal_msg msg = {};
 
   msg.adv.fields = new std::vector<std::string>();
   *msg.adv.fields = evnames;
@@ -225,7 +294,7 @@ void input_source::update_advanced(const std::vector<std::string>& evnames, adva
   
   msg.type = input_internal_msg::IN_ADV_TRANS_MSG;
 
-  write(priv_pipe, &msg, sizeof(msg));
+  msg_queue->post(msg);
 }
 
 
@@ -234,24 +303,22 @@ void input_source::update_advanced(const std::vector<std::string>& evnames, adva
 void input_source::set_trans(int id, event_translator* trans) {
   if (id < 0 || id >= events.size()) return;
 
-  struct input_internal_msg msg;
-  memset(&msg, 0, sizeof(msg));
+  struct input_internal_msg msg = {};
   msg.id = id;
   msg.field.trans = trans;
   msg.type = input_internal_msg::IN_TRANS_MSG;
-  write(priv_pipe, &msg, sizeof(msg));
+  msg_queue->post(msg);
 };
 
 void input_source::inject_event(int id, int64_t value, bool skip_adv_trans) {
   if (id < 0 || id >= events.size()) return;
 
-  struct input_internal_msg msg;
-  memset(&msg, 0, sizeof(msg));
+  struct input_internal_msg msg = {};
   msg.id = id;
   msg.value = value;
   msg.skip_adv_trans = skip_adv_trans;
   msg.type = input_internal_msg::IN_EVENT_MSG;
-  write(priv_pipe, &msg, sizeof(msg));
+  msg_queue->post(msg);
 
 }
 
@@ -272,11 +339,14 @@ bool notable_event(const entry_type type, const int64_t value, const int64_t old
 }
 
 void input_source::send_value(int id, int64_t value) {
-  if (id < 0 || id > events.size() || events[id].value == value)
+  if (id < 0 || id >= events.size() || events[id].value == value)
     return;
+  end_file_frame();
   bool blocked = false;
-  for (auto adv_trans : ev_map.at(id).attached) {
-    if (adv_trans->claim_event(id, {value})) blocked = true;
+  if (has_listeners(id)) {
+    for (int i = listener_start[id]; i < listener_start[id + 1]; i++) {
+      if (listeners[i]->claim_event(id, {value})) blocked = true;
+    }
   }
 
   //On a notable event, try to claim a slot if we don't have one.
@@ -295,12 +365,100 @@ void input_source::send_value(int id, int64_t value) {
 
   if (blocked) return;
 
-  if (ev_map.at(id).trans && out_dev) ev_map.at(id).trans->process({value}, out_dev);
+  if (out_dev) run_program(id, value);
     
 
 }
 
+void input_source::compile_program() {
+  program.clear();
+  program_start.assign(ev_map.size() + 1, 0);
+  for (int id = 0; id < ev_map.size(); id++) {
+    program_start[id] = program.size();
+    event_translator* trans = ev_map[id].trans;
+    //A plain event_translator is "nothing", so it needs no ops at all.
+    if (trans && typeid(*trans) != typeid(event_translator))
+      trans->compile(program, nullptr);
+  }
+  program_start[ev_map.size()] = program.size();
+  program_dirty = false;
+}
+
+//Send out whatever the translator for event id would, given this value.
+void input_source::run_program(int id, int64_t value) {
+  if (program_dirty)
+    compile_program();
+  struct input_event out_ev;
+  memset(&out_ev, 0, sizeof(out_ev));
+  for (int i = program_start[id]; i < program_start[id + 1]; i++) {
+    const trans_op& op = program[i];
+    output_slot* out = op.target ? op.target : out_dev;
+    switch (op.type) {
+    case trans_op::OP_KEY:
+      out_ev.type = EV_KEY;
+      out_ev.code = op.code;
+      out_ev.value = value;
+      break;
+    case trans_op::OP_ABS: {
+      int scaled = value * op.arg;
+      if (scaled < -ABS_RANGE) scaled = -ABS_RANGE;
+      if (scaled > ABS_RANGE) scaled = ABS_RANGE;
+      out_ev.type = EV_ABS;
+      out_ev.code = op.code;
+      out_ev.value = scaled;
+      break;
+    }
+    case trans_op::OP_KEY_ABS:
+      out_ev.type = EV_ABS;
+      out_ev.code = op.code;
+      out_ev.value = value * op.arg * ABS_RANGE;
+      break;
+    case trans_op::OP_KEY_BELOW:
+    case trans_op::OP_KEY_ABOVE: {
+      int pressed = (op.type == trans_op::OP_KEY_BELOW) ? value < -.5 * ABS_RANGE : value > .5 * ABS_RANGE;
+      if (pressed == *op.state)
+        continue;
+      *op.state = pressed;
+      out_ev.type = EV_KEY;
+      out_ev.code = op.code;
+      out_ev.value = pressed;
+      break;
+    }
+    case trans_op::OP_SYN:
+      out_ev.type = EV_SYN;
+      out_ev.code = SYN_REPORT;
+      out_ev.value = 0;
+      break;
+    case trans_op::OP_CALL:
+      op.trans->process({value}, out);
+      continue;
+    }
+    out->take_event(out_ev);
+  }
+}
+
 void input_source::send_syn_report() {
+  //While handling a batch, multiple files might report the end of a frame.
+  //Coalesce them into a single SYN_REPORT sent after the batch.
+  //A file that goes on to send events of its next frame first ends the
+  //pending one though; see end_file_frame.
+  if (in_batch) {
+    syn_pending = true;
+    file_synced = true;
+    return;
+  }
+  write_syn_report();
+}
+
+//Called before an event goes out. If the file being processed already ended
+//a frame, this event starts its next one, so the pending SYN_REPORT must go first.
+void input_source::end_file_frame() {
+  if (syn_pending && file_synced)
+    write_syn_report();
+}
+
+void input_source::write_syn_report() {
+  syn_pending = false;
   if (out_dev) {
     input_event ev;
     memset(&ev,0,sizeof(ev));
@@ -311,6 +469,7 @@ void input_source::send_syn_report() {
 }
 
 void input_source::force_value(int id, int64_t value) {
+  end_file_frame();
 
   //On a notable event, try to claim a slot if we don't have one.
   if (!out_dev && notable_event(events[id].type, value, events[id].value)) {
@@ -327,7 +486,7 @@ void input_source::force_value(int id, int64_t value) {
 
   events.at(id).value = value;
 
-  if (ev_map.at(id).trans && out_dev) ev_map.at(id).trans->process({value}, out_dev);
+  if (out_dev) run_program(id, value);
 
 }
 
@@ -335,43 +494,137 @@ void input_source::force_value(int id, int64_t value) {
 
 
 void input_source::thread_loop() {
-  struct epoll_event event;
-  struct epoll_event events[1];
-  memset(&event, 0, sizeof(event));
+  while ((keep_looping)) {
+    if (!dispatch(recurring_timeout()))
+      break;
+  }
+}
 
-  memset(&last_recurring_update,0,sizeof(timespec));
+static int64_t monotonic_ns() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
-  while ((keep_looping)) {
-    int timeout = -1;
-    if (do_recurring_events) {
-      //try to set epoll_wait to timeout at the next 10ms interval.
-      timeout = 10 - ms_since_last_recurring_update();
-      timeout = timeout < 0 ? 0 : timeout;
-    }
+//Orders recurring_events as a min-heap on due time.
+static bool due_later(const recurring_info& a, const recurring_info& b) {
+  return a.due > b.due;
+}
 
-    int n = epoll_wait(epfd, events, 1, timeout);
-    if (n < 0 && errno == EINTR) {
-      continue;
+//Milliseconds until recurring events are next due, or -1 if there are none.
+//Also -1 when our timerfd will wake the epoll set instead.
+int input_source::recurring_timeout() {
+  if (!do_recurring_events || recurring_timer >= 0)
+    return -1;
+  int64_t timeout = recurring_events.front().due - monotonic_ns();
+  if (timeout <= 0)
+    return 0;
+  return (timeout + 999999) / 1000000;
+}
+
+bool input_source::recurring_due() {
+  return do_recurring_events && recurring_events.front().due <= monotonic_ns();
+}
+
+//Wait up to timeout ms, then handle whatever is ready and any due recurring events.
+//Returns false if the epoll set is unusable.
+bool input_source::dispatch(int timeout) {
+  struct epoll_event events[MAX_BATCH_SIZE];
+
+  int n = epoll_wait(epfd, events, batch_size, timeout);
+  if (n < 0 && errno == EINTR) {
+    return true;
+  }
+  if (n < 0 && errno != EINTR) {
+    perror("epoll wait:");
+    return false;
+  }
+  output_slot::current_producer = this;
+  if (recurring_due()) {
+    process_recurring_events();
+  }
+
+  //Handle every ready file before sending a single SYN_REPORT for all of them.
+  in_batch = batch_size > 1;
+  for (int i = 0; i < n; i++) {
+    file_synced = false;
+    if (events[i].data.ptr == this) {
+      drain_internal_messages();
+    } else if (events[i].data.ptr == &recurring_timer) {
+      //Already handled above, just clear the expiration count.
+      uint64_t expirations;
+      read(recurring_timer, &expirations, sizeof(expirations));
+    } else {
+      process(events[i].data.ptr);
     }
-    if (n < 0 && errno != EINTR) {
-      perror("epoll wait:");
-      break;
+  }
+  in_batch = false;
+  if (syn_pending)
+    send_syn_report();
+  //Input may have given idle recurring translators something to do.
+  if (!parked_recurring.empty())
+    wake_recurring();
+  output_slot::current_producer = nullptr;
+  return true;
+}
+
+void input_source::drain_internal_messages() {
+  uint64_t count;
+  read(msg_queue->doorbell, &count, sizeof(count));
+  //Reset before draining, so anything posted after this point rings again.
+  msg_queue->rung = false;
+
+  struct input_internal_msg msg;
+  while (msg_queue->ring.pop(msg))
+    handle_internal_message(msg);
+
+  if (msg_queue->overflowing) {
+    //The ring may have filled again before we looked. While overflowing is set
+    //producers only spill, so whatever is in the ring now predates the spill.
+    while (msg_queue->ring.pop(msg))
+      handle_internal_message(msg);
+
+    std::vector<input_internal_msg> spilled;
+    {
+      std::lock_guard<std::mutex> guard(msg_queue->overflow_lock);
+      spilled.swap(msg_queue->overflow);
+      msg_queue->overflowing = false;
     }
-    if (do_recurring_events && (n == 0 || timeout == 0)) {
-      process_recurring_events();
+    for (auto& spilled_msg : spilled)
+      handle_internal_message(spilled_msg);
+  }
+
+  //Mapping changes usually come in bunches, so only recompute once they are all in.
+  if (event_mask_dirty)
+    update_event_mask();
+}
+
+//Tell the plugin which events currently lead anywhere.
+void input_source::update_event_mask() {
+  event_mask_dirty = false;
+  if (!plugin.update_event_mask)
+    return;
+  std::vector<unsigned char> wanted(events.size(), 0);
+  for (int id = 0; id < events.size(); id++) {
+    if (events[id].state != EVENT_ACTIVE)
       continue;
-    }
-    if (events[0].data.ptr == this) {
-      struct input_internal_msg msg;
-      int ret = 1;
-      ret = read(internalpipe, &msg, sizeof(msg));
-      if (ret == sizeof(msg)) {
-        handle_internal_message(msg);
-      }
-    } else {
-      process(events[0].data.ptr);
-    }
+    event_translator* trans = ev_map[id].trans;
+    //A plain event_translator is "nothing".
+    bool mapped = trans && typeid(*trans) != typeid(event_translator);
+    //Without a slot, any key or axis might be what gets us one.
+    bool may_claim_slot = !out_dev && (events[id].type == DEV_KEY || events[id].type == DEV_AXIS);
+    wanted[id] = mapped || has_listeners(id) || may_claim_slot;
   }
+  //Nothing more will be heard from newly masked events, release included.
+  //Forget their values, so the first press after they come back is not
+  //dropped as unchanged.
+  masked_events.resize(events.size(), 0);
+  for (int id = 0; id < events.size(); id++) {
+    if (!wanted[id] && !masked_events[id])
+      events[id].value = 0;
+    masked_events[id] = !wanted[id];
+  }
+  plugin.update_event_mask(plug_data, wanted.size(), wanted.data());
 }
 
 void input_source::handle_internal_message(input_internal_msg& msg) {
@@ -405,7 +658,7 @@ void input_source::handle_internal_message(input_internal_msg& msg) {
     } else {
       delete msg.adv.fields;
     }
-    do_recurring_events = recurring_events.size() + adv_recurring_events.size() > 0;
+    event_mask_dirty = true;
     return;
   }
   if (msg.type == input_internal_msg::IN_TRANS_MSG) {
@@ -420,11 +673,12 @@ void input_source::handle_internal_message(input_internal_msg& msg) {
     remove_recurring_event(*trans);
     delete *trans;
     *(trans) = msg.field.trans;
+    program_dirty = true;
     msg.field.trans->attach(this);
     if (msg.field.trans->wants_recurring_events()) {
       add_recurring_event(msg.field.trans, msg.id);
     }
-    do_recurring_events = recurring_events.size() + adv_recurring_events.size() > 0;
+    event_mask_dirty = true;
   }
   if (msg.type == input_internal_msg::IN_EVENT_MSG) {
     //Is it an event injection message?
@@ -436,8 +690,11 @@ void input_source::handle_internal_message(input_internal_msg& msg) {
       send_value(msg.id, msg.value);
     }
   }
-  if (msg.type == input_internal_msg::IN_SLOT_MSG)
+  if (msg.type == input_internal_msg::IN_SLOT_MSG) {
     out_dev = msg.field.slot;
+    //Having a slot or not changes which events must be left unmasked.
+    event_mask_dirty = true;
+  }
   if (msg.type == input_internal_msg::IN_OPTION_MSG) {
     std::lock_guard<std::mutex> lock(opt_lock);
     std::string sname = std::string(msg.name);
@@ -457,17 +714,75 @@ void input_source::handle_internal_message(input_internal_msg& msg) {
 
 }
 
+static bool recurring_active(const recurring_info& rec) {
+  return rec.trans ? rec.trans->recurring_active() : rec.adv->recurring_active();
+}
+
+//Run everything that is due, then reschedule it one period later.
+//Idle entries are parked instead, so an idle device stops waking up.
 void input_source::process_recurring_events() {
-  for (auto rec : recurring_events) {
-    if (out_dev && events[rec.id].state == EVENT_ACTIVE) {
-      rec.trans->process_recurring(out_dev);
+  int64_t now = monotonic_ns();
+  bool ran = false;
+  while (!recurring_events.empty() && recurring_events.front().due <= now) {
+    std::pop_heap(recurring_events.begin(), recurring_events.end(), due_later);
+    recurring_info& rec = recurring_events.back();
+    if (!recurring_active(rec)) {
+      parked_recurring.push_back(rec);
+      recurring_events.pop_back();
+      continue;
+    }
+    if (rec.trans) {
+      if (out_dev && events[rec.id].state == EVENT_ACTIVE)
+        rec.trans->process_recurring(out_dev);
+    } else {
+      rec.adv->process_recurring(out_dev);
     }
+    rec.due += rec.period;
+    //After a stall, carry on from now rather than trying to catch up.
+    if (rec.due <= now)
+      rec.due = now + rec.period;
+    std::push_heap(recurring_events.begin(), recurring_events.end(), due_later);
+    ran = true;
   }
-  for (const advanced_event_translator* adv : adv_recurring_events) {
-    adv->process_recurring(out_dev);
+  do_recurring_events = !recurring_events.empty();
+  if (ran)
+    send_syn_report();
+  arm_recurring_timer();
+}
+
+//Put parked entries that became active back on the schedule.
+void input_source::wake_recurring() {
+  int64_t now = monotonic_ns();
+  bool woke = false;
+  for (auto it = parked_recurring.begin(); it != parked_recurring.end();) {
+    if (!recurring_active(*it)) {
+      it++;
+      continue;
+    }
+    it->due = now + it->period;
+    recurring_events.push_back(*it);
+    std::push_heap(recurring_events.begin(), recurring_events.end(), due_later);
+    it = parked_recurring.erase(it);
+    woke = true;
+  }
+  if (woke) {
+    do_recurring_events = true;
+    arm_recurring_timer();
   }
-  send_syn_report();
-  clock_gettime(CLOCK_MONOTONIC, &last_recurring_update);
+}
+
+void input_source::arm_recurring_timer() {
+  if (recurring_timer < 0)
+    return;
+  //An all zero value disarms the timer.
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  if (!recurring_events.empty()) {
+    int64_t due = recurring_events.front().due;
+    spec.it_value.tv_sec = due / 1000000000;
+    spec.it_value.tv_nsec = due % 1000000000;
+  }
+  timerfd_settime(recurring_timer, TFD_TIMER_ABSTIME, &spec, nullptr);
 }
 
 std::string input_source::get_alias(std::string event_name) const {
@@ -480,17 +795,27 @@ std::string input_source::get_alias(std::string event_name) const {
 void input_source::start_thread() {
   keep_looping = true;
 
+  //With a shared engine, one of its workers runs our event loop instead.
+  engine = manager->mg->engine;
+  if (engine) {
+    engine->add_source(this);
+    return;
+  }
+
   thread = new std::thread(&input_source::thread_loop, this);
 }
 
 
 void input_source::end_thread() {
+  if (engine) {
+    engine->remove_source(this);
+    engine = nullptr;
+  }
   if (thread) {
     keep_looping = false;
-    struct input_internal_msg msg;
-    memset(&msg, 0, sizeof(msg));
+    struct input_internal_msg msg = {};
     msg.type = input_internal_msg::IN_END_THREAD_MSG;
-    write(priv_pipe, &msg, sizeof(msg));
+    msg_queue->post(msg);
     thread->join();
     delete thread;
     thread = nullptr;
@@ -499,52 +824,73 @@ void input_source::end_thread() {
 
 void input_source::add_listener(int id, advanced_event_translator* trans) {
   if (id < 0 || id >= events.size()) return;
-  ev_map[id].attached.push_back(trans);
+  //Listeners change rarely, so shifting the later slices here is fine.
+  listeners.insert(listeners.begin() + listener_start[id + 1], trans);
+  for (int i = id + 1; i < listener_start.size(); i++)
+    listener_start[i]++;
+  listener_bits[id >> 6] |= 1ULL << (id & 63);
 }
 
 void input_source::remove_listener(int id, advanced_event_translator* trans) {
-  if (id < 0 || id >= ev_map.size()) return;
-  for (auto it = ev_map[id].attached.begin(); it != ev_map[id].attached.end(); it++) {
-    if (*it == trans) {
-      ev_map[id].attached.erase(it);
-      return;
-    }
+  if (id < 0 || id >= events.size()) return;
+  for (int i = listener_start[id]; i < listener_start[id + 1]; i++) {
+    if (listeners[i] != trans)
+      continue;
+    listeners.erase(listeners.begin() + i);
+    for (int j = id + 1; j < listener_start.size(); j++)
+      listener_start[j]--;
+    if (listener_start[id] == listener_start[id + 1])
+      listener_bits[id >> 6] &= ~(1ULL << (id & 63));
+    return;
   }
 }
 
 
+void input_source::add_recurring(recurring_info info) {
+  if (info.period < 1000000)
+    info.period = 1000000;
+  info.due = monotonic_ns() + info.period;
+  recurring_events.push_back(info);
+  std::push_heap(recurring_events.begin(), recurring_events.end(), due_later);
+  do_recurring_events = true;
+  arm_recurring_timer();
+}
+
 void input_source::add_recurring_event(const event_translator* trans, int id) {
-  recurring_events.push_back({trans, id});
+  add_recurring({trans, nullptr, id, (int64_t)trans->recurring_period() * 1000000, 0});
 }
 
 void input_source::remove_recurring_event(const event_translator* trans) {
-  for (auto it = recurring_events.begin(); it != recurring_events.end(); it++) {
-    if (it->trans == trans) {
-      recurring_events.erase(it);
-      return;
-    }
-  }
+  drop_recurring(trans);
 }
 
 void input_source::add_adv_recurring_event(const advanced_event_translator* trans) {
-  adv_recurring_events.push_back(trans);
+  add_recurring({nullptr, trans, -1, (int64_t)trans->recurring_period() * 1000000, 0});
 }
 
 void input_source::remove_adv_recurring_event(const advanced_event_translator* trans) {
-  for (auto it = adv_recurring_events.begin(); it != adv_recurring_events.end(); it++) {
-    if (*it == trans) {
-      adv_recurring_events.erase(it);
+  drop_recurring(trans);
+}
+
+//Forget a translator, whether scheduled or parked.
+void input_source::drop_recurring(const void* trans) {
+  if (!trans)
+    return;
+  for (auto it = parked_recurring.begin(); it != parked_recurring.end(); it++) {
+    if (it->trans == trans || it->adv == trans) {
+      parked_recurring.erase(it);
+      return;
+    }
+  }
+  for (auto it = recurring_events.begin(); it != recurring_events.end(); it++) {
+    if (it->trans == trans || it->adv == trans) {
+      recurring_events.erase(it);
+      std::make_heap(recurring_events.begin(), recurring_events.end(), due_later);
+      do_recurring_events = !recurring_events.empty();
+      arm_recurring_timer();
       return;
     }
   }
-}
-
-int64_t input_source::ms_since_last_recurring_update() {
-  timespec now;
-  clock_gettime(CLOCK_MONOTONIC, &now);
-  int64_t delta_sec = now.tv_sec - last_recurring_update.tv_sec;
-  int64_t delta_nsec = now.tv_nsec - last_recurring_update.tv_nsec;
-  return delta_sec*1000 + delta_nsec/1000000;
 }
 
 std::string input_source::get_manager_name() const {
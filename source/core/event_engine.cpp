@@ -0,0 +1,145 @@
+#include "event_engine.h"
+#include "devices/device.h"
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+//How many ready sources a worker picks up per epoll_wait.
+#define WORKER_MAX_EVENTS 32
+
+event_engine::event_engine(int threads) {
+  if (threads <= 0)
+    threads = std::thread::hardware_concurrency();
+  if (threads <= 0)
+    threads = 1;
+
+  for (int i = 0; i < threads; i++) {
+    worker* w = new worker();
+    w->epfd = epoll_create(1);
+    if (w->epfd < 1) perror("epoll create");
+    w->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (w->wakefd < 0) perror("eventfd");
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = w;
+    if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->wakefd, &event) < 0)
+      perror("epoll add");
+
+    workers.push_back(w);
+  }
+
+  for (auto w : workers)
+    w->thread = new std::thread(&event_engine::worker_loop, this, w);
+}
+
+event_engine::~event_engine() {
+  keep_looping = false;
+  for (auto w : workers) {
+    uint64_t one = 1;
+    write(w->wakefd, &one, sizeof(one));
+  }
+  for (auto w : workers) {
+    w->thread->join();
+    delete w->thread;
+    close(w->wakefd);
+    close(w->epfd);
+    delete w;
+  }
+  workers.clear();
+}
+
+void event_engine::add_source(input_source* source) {
+  std::lock_guard<std::mutex> guard(assign_lock);
+  //Place the source with whichever worker currently has the fewest.
+  worker* target = workers.front();
+  for (auto w : workers) {
+    if (w->sources.size() < target->sources.size())
+      target = w;
+  }
+
+  {
+    std::lock_guard<std::recursive_mutex> worker_guard(target->lock);
+    target->sources.push_back(source);
+  }
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = source;
+  if (epoll_ctl(target->epfd, EPOLL_CTL_ADD, source->epfd, &event) < 0)
+    perror("epoll add");
+}
+
+void event_engine::remove_source(input_source* source) {
+  std::lock_guard<std::mutex> guard(assign_lock);
+  worker* w = find_worker(source);
+  if (!w) return;
+
+  epoll_ctl(w->epfd, EPOLL_CTL_DEL, source->epfd, nullptr);
+  //Taking the worker lock waits out any batch currently using this source.
+  std::lock_guard<std::recursive_mutex> worker_guard(w->lock);
+  auto it = std::find(w->sources.begin(), w->sources.end(), source);
+  if (it != w->sources.end())
+    w->sources.erase(it);
+}
+
+//Caller must hold assign_lock, the only lock under which source lists change.
+event_engine::worker* event_engine::find_worker(input_source* source) {
+  for (auto w : workers) {
+    if (std::find(w->sources.begin(), w->sources.end(), source) != w->sources.end())
+      return w;
+  }
+  return nullptr;
+}
+
+void event_engine::worker_loop(worker* w) {
+  struct epoll_event events[WORKER_MAX_EVENTS];
+  memset(events, 0, sizeof(events));
+
+  while (keep_looping) {
+    //Sleep until the earliest recurring event among our sources.
+    int timeout = -1;
+    {
+      std::lock_guard<std::recursive_mutex> guard(w->lock);
+      for (auto source : w->sources) {
+        int source_timeout = source->recurring_timeout();
+        if (source_timeout >= 0 && (timeout < 0 || source_timeout < timeout))
+          timeout = source_timeout;
+      }
+    }
+
+    int n = epoll_wait(w->epfd, events, WORKER_MAX_EVENTS, timeout);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno != EINTR) {
+      perror("epoll wait:");
+      break;
+    }
+
+    std::lock_guard<std::recursive_mutex> guard(w->lock);
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == w) {
+        uint64_t count;
+        read(w->wakefd, &count, sizeof(count));
+        continue;
+      }
+      input_source* source = (input_source*) events[i].data.ptr;
+      //It might have been removed after epoll_wait returned.
+      if (std::find(w->sources.begin(), w->sources.end(), source) == w->sources.end())
+        continue;
+      source->dispatch(0);
+    }
+
+    //Sources with nothing to read may still have recurring events due.
+    for (size_t i = 0; i < w->sources.size(); i++) {
+      if (w->sources[i]->recurring_timeout() == 0)
+        w->sources[i]->dispatch(0);
+    }
+  }
+}
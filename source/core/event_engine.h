@@ -0,0 +1,44 @@
+#ifndef EVENT_ENGINE_H
+#define EVENT_ENGINE_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+
+class input_source;
+
+//A fixed pool of event loop threads shared by all input sources.
+//
+//Each input_source keeps its own epoll set. Instead of giving every source
+//its own thread, the engine nests those epoll sets inside the epoll set of
+//one worker. A source stays with the same worker for its whole life, so its
+//events are still handled in order by a single thread.
+class event_engine {
+public:
+  //threads <= 0 picks one worker per CPU core.
+  event_engine(int threads);
+  ~event_engine();
+
+  void add_source(input_source* source);
+  //Once this returns, no worker is touching the source.
+  void remove_source(input_source* source);
+
+  int size() const { return workers.size(); };
+
+private:
+  struct worker {
+    int epfd;
+    int wakefd; //eventfd used to interrupt epoll_wait
+    std::thread* thread = nullptr;
+    std::recursive_mutex lock; //held while servicing sources
+    std::vector<input_source*> sources;
+  };
+  std::vector<worker*> workers;
+  std::mutex assign_lock;
+  volatile bool keep_looping = true;
+
+  void worker_loop(worker* w);
+  worker* find_worker(input_source* source);
+};
+
+#endif
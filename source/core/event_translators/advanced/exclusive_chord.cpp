@@ -12,29 +12,30 @@ void exclusive_chord::fill_def(MGTransDef& def) {
 }
 
 bool exclusive_chord::claim_event(int id, mg_ev event) {
-  bool output = true;
-  int index;
-  int old_val;
-
-  for (int i = 0; i < event_ids.size(); i++) {
-    if (id == event_ids[i]) {
-      index = i;
-      old_val = event_vals[i];
-      event_vals[i] = event.value;
-      if (event.value != old_val) chord_hits[i] = event.value;
-      
+  int index = -1;
+  int old_val = 0;
+
+  //Usually just one position, so this stays O(1) whatever the chord size.
+  for (uint64_t bits = bits_for(id); bits; bits &= bits - 1) {
+    int i = __builtin_ctzll(bits);
+    uint64_t bit = 1ULL << i;
+    index = i;
+    old_val = event_vals[i];
+    event_vals[i] = event.value;
+    if (event.value != old_val) {
+      if (event.value)
+        hit_bits |= bit;
+      else
+        hit_bits &= ~bit;
     }
-    output = output && (chord_hits[i]);
   }
+  bool output = hit_bits == all_bits;
 
   //if not thread, start thread.
-  if (!output && !chord_active && event.value && !old_val) {
+  if (!output && !chord_active && event.value && !old_val && index >= 0) {
 
     chord_active = true;
-    for (int i = 0; i < event_vals.size(); i++) {
-      chord_hits[i] = 0;
-    }
-    chord_hits[index] = event.value;
+    hit_bits = 1ULL << index;
     tick_count = 2;
   }
 
@@ -52,9 +53,7 @@ bool exclusive_chord::claim_event(int id, mg_ev event) {
     //chord released. clear out everything.
     output_slot* out_dev = owner->get_slot();
     if (out_dev) out_trans->process({output}, out_dev);
-    for (int i = 0; i < event_vals.size(); i++) {
-      chord_hits[i] = 0;
-    }
+    hit_bits = 0;
     output_cache = output;
   }
   //If key up, let it pass.
@@ -75,10 +74,11 @@ void exclusive_chord::process_recurring(output_slot* out) const {
     return;
   if (chord_active && tick_count == 0) {
     //send out events
-    for (int i = 0; i < event_ids.size(); i++) {
-      if (chord_hits[i]) owner->inject_event(event_ids[i], event_vals[i], true);
-      chord_hits[i] = 0;
+    for (uint64_t bits = hit_bits; bits; bits &= bits - 1) {
+      int i = __builtin_ctzll(bits);
+      owner->inject_event(event_ids[i], event_vals[i], true);
     }
+    hit_bits = 0;
     chord_active = false;
   }
     
@@ -91,7 +91,6 @@ void exclusive_chord::init(input_source* source) {
   for (auto name : event_names) {
     event_ids.push_back(-1);
     event_vals.push_back(0);
-    chord_hits.push_back(0);
   }
 
   for (int i = 0; i < event_names.size(); i++) {
@@ -106,6 +105,7 @@ void exclusive_chord::init(input_source* source) {
       }
     }
   }
+  build_masks(events.size());
 
   tick_count = 2;
   chord_active = false;
@@ -8,7 +8,7 @@ public:
   exclusive_chord(std::vector<std::string> event_names, event_translator* trans) : simple_chord(event_names, trans) {};
 
   volatile std::thread* thread = nullptr;
-  mutable std::vector<int> chord_hits;
+  mutable uint64_t hit_bits = 0; //positions pressed since the chord started, as in held_bits
   input_source* owner = nullptr;
 
   virtual void init(input_source* source);
@@ -22,6 +22,7 @@ public:
   mutable int tick_count;
 
   virtual bool wants_recurring_events() { return true; };
+  virtual bool recurring_active() const { return chord_active; };
   virtual void process_recurring(output_slot* out) const;
 
   static const char* decl;
@@ -36,9 +36,23 @@ void simple_chord::init(input_source* source) {
       }
     }
   }
-
+  build_masks(events.size());
 };
 
+void simple_chord::build_masks(int event_count) {
+  id_bits.assign(event_count, 0);
+  all_bits = 0;
+  held_bits = 0;
+  for (int i = 0; i < event_ids.size() && i < 64; i++) {
+    uint64_t bit = 1ULL << i;
+    all_bits |= bit;
+    //An event this device lacks keeps its bit out of reach, so the chord never fires.
+    if (event_ids[i] < 0) continue;
+    id_bits[event_ids[i]] |= bit;
+    if (event_vals[i]) held_bits |= bit;
+  }
+}
+
 void simple_chord::attach(input_source* source) {
   for (int id : event_ids)
     source->add_listener(id, this);
@@ -56,13 +70,12 @@ simple_chord::~simple_chord() {
 }
 
 bool simple_chord::claim_event(int id, mg_ev event) {
-  bool output = true;
-  for (int i = 0; i < event_ids.size(); i++) {
-    if (id == event_ids[i]) {
-      event_vals[i] = event.value;
-    }
-    output = output && (event_vals[i]);
-  }
+  uint64_t bits = bits_for(id);
+  if (event.value)
+    held_bits |= bits;
+  else
+    held_bits &= ~bits;
+  bool output = held_bits == all_bits;
   if (output != output_cache) {
     output_slot* out_dev = owner->get_slot();
     if (out_dev) out_trans->process({output}, out_dev);
@@ -6,6 +6,10 @@ public:
   std::vector<std::string> event_names;
   std::vector<int> event_ids;
   std::vector<int> event_vals;
+  //Bit i stands for event_ids[i]. Only the first 64 events of a chord are tracked.
+  std::vector<uint64_t> id_bits; //event id -> the chord positions it fills
+  uint64_t all_bits = 0;
+  uint64_t held_bits = 0; //positions whose event is currently non-zero
   int output_cache = 0;
   input_source* owner = nullptr;
   event_translator* out_trans = nullptr;
@@ -28,4 +32,8 @@ public:
   virtual void fill_def(MGTransDef& def);
 protected:
   simple_chord() {};
+  void build_masks(int event_count);
+  uint64_t bits_for(int id) const {
+    return (id >= 0 && id < id_bits.size()) ? id_bits[id] : 0;
+  };
 };
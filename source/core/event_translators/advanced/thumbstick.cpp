@@ -63,7 +63,7 @@ void thumb_stick::attach(input_source* source) {
 thumb_stick::~thumb_stick() {
   if (owner) {
     owner->remove_listener(event_ids[0], this);
-    owner->remove_listener(event_ids[0], this);
+    owner->remove_listener(event_ids[1], this);
   }
 }
 
@@ -18,6 +18,9 @@ public:
     out_ev.value = value;
     write_out(out_ev, out);
   }
+  virtual void compile(std::vector<trans_op>& ops, output_slot* target) {
+    ops.push_back({trans_op::OP_ABS, out_axis, direction, nullptr, this, target});
+  }
 
   virtual axis2axis* clone() {
     return new axis2axis(*this);
@@ -22,6 +22,11 @@ void axis2btns::process(struct mg_ev ev, output_slot* out) {
 
 }
 
+void axis2btns::compile(std::vector<trans_op>& ops, output_slot* target) {
+  ops.push_back({trans_op::OP_KEY_BELOW, neg_btn, 0, &neg_cache, this, target});
+  ops.push_back({trans_op::OP_KEY_ABOVE, pos_btn, 0, &pos_cache, this, target});
+}
+
 const char* axis2btns::decl = "axis = axis2btns(key_code, key_code)";
 axis2btns::axis2btns(std::vector<MGField>& fields) {
   BEGIN_READ_DEF;
@@ -12,6 +12,7 @@ public:
   }
 
   virtual void process(struct mg_ev ev, output_slot* out);
+  virtual void compile(std::vector<trans_op>& ops, output_slot* target);
 
   virtual axis2btns* clone() {
     return new axis2btns(*this);
@@ -1,5 +1,6 @@
 #include "axis2rel.h"
 #include "../event_translator_macros.h"
+#include <cmath>
 
 bool axis2rel::wants_recurring_events() {
   return true;
@@ -8,7 +9,17 @@ bool axis2rel::wants_recurring_events() {
 
 
 void axis2rel::process(struct mg_ev ev, output_slot* out) {
-  value = ev.value * speed / ABS_RANGE;
+  if (curve == 1) {
+    value = ev.value * speed * REL_FRAC_ONE / ABS_RANGE;
+  } else {
+    //Shape the deflection while keeping its sign and the full scale speed.
+    double deflection = std::pow(std::fabs((double)ev.value / ABS_RANGE), curve);
+    value = (int64_t)std::copysign(deflection * speed * REL_FRAC_ONE, (double)ev.value);
+  }
+  //We get parked before another tick, so drop the leftover fraction here.
+  //Otherwise it would leak into the next, unrelated motion.
+  if (!value)
+    remainder = 0;
 }
 
 void axis2rel::process_recurring(output_slot* out) const {
@@ -16,18 +27,27 @@ void axis2rel::process_recurring(output_slot* out) const {
   memset(&out_ev, 0, sizeof(out_ev));
   out_ev.type = EV_REL;
   out_ev.code = out_rel;
-  out_ev.value = value;
-  if (value) write_out(out_ev, out);
+  //Scale to our tick, keeping any fraction for the next one.
+  int64_t motion = value * tick_ms / RECURRING_PERIOD_MS + remainder;
+  out_ev.value = motion / REL_FRAC_ONE;
+  remainder = value ? motion - out_ev.value * REL_FRAC_ONE : 0;
+  if (out_ev.value) write_out(out_ev, out);
 }
 
-const char* axis2rel::decl = "axis = axis2rel(rel_code, int speed=10)";
+const char* axis2rel::decl = "axis = axis2rel(rel_code, int speed=10, int tick_ms=10, float curve=1)";
 axis2rel::axis2rel(std::vector<MGField>& fields) {
   BEGIN_READ_DEF;
   READ_REL(out_rel);
   READ_INT(speed);
+  READ_INT(tick_ms);
+  if (tick_ms < 1) tick_ms = 1;
+  READ_FLOAT(curve);
+  if (curve <= 0) curve = 1;
 }
 void axis2rel::fill_def(MGTransDef& def) {
   BEGIN_FILL_DEF("axis2rel");
   FILL_DEF_REL(out_rel);
   FILL_DEF_INT(speed);
+  FILL_DEF_INT(tick_ms);
+  FILL_DEF_FLOAT(curve);
 }
@@ -5,7 +5,10 @@ class axis2rel : public event_translator {
 public:
   int out_rel;
   int speed = 1;
-  volatile int value = 0;
+  volatile int64_t value = 0; //motion per RECURRING_PERIOD_MS, REL_FRAC_BITS fixed point
+  int tick_ms = RECURRING_PERIOD_MS; //speed is still per RECURRING_PERIOD_MS
+  float curve = 1; //exponent applied to the deflection; above 1 gives finer control near center
+  mutable int64_t remainder = 0; //motion too small to send yet
   axis2rel(int out, int speed) : out_rel(out), speed(speed) {
   }
 
@@ -13,6 +16,8 @@ public:
   virtual void process(struct mg_ev ev, output_slot* out);
   virtual void process_recurring(output_slot* out) const;
   virtual bool wants_recurring_events();
+  virtual int recurring_period() const { return tick_ms; };
+  virtual bool recurring_active() const { return value != 0; };
 
   virtual axis2rel* clone() {
     return new axis2rel(*this);
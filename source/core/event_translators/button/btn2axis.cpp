@@ -10,6 +10,10 @@ void btn2axis::process(struct mg_ev ev, output_slot* out) {
   write_out(out_ev, out);
 }
 
+void btn2axis::compile(std::vector<trans_op>& ops, output_slot* target) {
+  ops.push_back({trans_op::OP_KEY_ABS, out_axis, direction, nullptr, this, target});
+}
+
 const char* btn2axis::decl = "key = btn2axis(axis_code, int direction=1)";
 btn2axis::btn2axis(std::vector<MGField>& fields) {
   BEGIN_READ_DEF;
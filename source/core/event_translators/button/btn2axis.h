@@ -10,6 +10,7 @@ public:
   }
 
   virtual void process(struct mg_ev ev, output_slot* out);
+  virtual void compile(std::vector<trans_op>& ops, output_slot* target);
 
   virtual btn2axis* clone() {
     return new btn2axis(*this);
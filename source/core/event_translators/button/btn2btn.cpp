@@ -9,6 +9,10 @@ void btn2btn::process(struct mg_ev ev, output_slot* out) {
   out_ev.value = ev.value;
   write_out(out_ev, out);
 }
+void btn2btn::compile(std::vector<trans_op>& ops, output_slot* target) {
+  ops.push_back({trans_op::OP_KEY, out_button, 0, nullptr, this, target});
+}
+
 const char* btn2btn::decl = "key = btn2btn(key_code)";
 btn2btn::btn2btn(std::vector<MGField>& fields) {
   BEGIN_READ_DEF;
@@ -8,6 +8,7 @@ public:
   }
 
   virtual void process(struct mg_ev ev, output_slot* out);
+  virtual void compile(std::vector<trans_op>& ops, output_slot* target);
 
   virtual btn2btn* clone() {
     return new btn2btn(*this);
@@ -8,7 +8,10 @@ bool btn2rel::wants_recurring_events() {
 
 
 void btn2rel::process(struct mg_ev ev, output_slot* out) {
-  value = ev.value ? speed : 0;
+  value = ev.value ? speed * REL_FRAC_ONE : 0;
+  //We get parked before another tick, so drop the leftover fraction here.
+  if (!value)
+    remainder = 0;
 }
 
 void btn2rel::process_recurring(output_slot* out) const {
@@ -16,18 +19,24 @@ void btn2rel::process_recurring(output_slot* out) const {
   memset(&out_ev, 0, sizeof(out_ev));
   out_ev.type = EV_REL;
   out_ev.code = out_rel;
-  out_ev.value = value;
-  if (value) write_out(out_ev, out);
+  //Scale to our tick, keeping any fraction for the next one.
+  int64_t motion = value * tick_ms / RECURRING_PERIOD_MS + remainder;
+  out_ev.value = motion / REL_FRAC_ONE;
+  remainder = value ? motion - out_ev.value * REL_FRAC_ONE : 0;
+  if (out_ev.value) write_out(out_ev, out);
 }
 
-const char* btn2rel::decl = "key = btn2rel(rel_code, int speed=3)";
+const char* btn2rel::decl = "key = btn2rel(rel_code, int speed=3, int tick_ms=10)";
 btn2rel::btn2rel(std::vector<MGField>& fields) {
   BEGIN_READ_DEF;
   READ_REL(out_rel);
   READ_INT(speed);
+  READ_INT(tick_ms);
+  if (tick_ms < 1) tick_ms = 1;
 }
 void btn2rel::fill_def(MGTransDef& def) {
   BEGIN_FILL_DEF("btn2rel");
   FILL_DEF_REL(out_rel);
   FILL_DEF_INT(speed);
+  FILL_DEF_INT(tick_ms);
 }
@@ -7,11 +7,19 @@
 #include "../devices/device.h"
 #include "../moltengamepad.h"
 #include "../mg_types.h"
+#include "trans_op.h"
 
 
 #define EVENT_KEY 0
 #define EVENT_AXIS 1
 
+//Default milliseconds between recurring "ticks".
+#define RECURRING_PERIOD_MS 10
+//Relative motion is tracked in fixed point with this many fractional bits,
+//so slow movement at short tick periods is carried over instead of lost.
+#define REL_FRAC_BITS 16
+#define REL_FRAC_ONE ((int64_t)1 << REL_FRAC_BITS)
+
 
 struct mg_ev {
   int64_t value;
@@ -50,9 +58,19 @@ public:
   
   //Called when the device's thread is ready for attaching.
   virtual void attach(input_source* source) {};
+
+  //Append ops doing what process() does, with output going to target.
+  //Translators without a cheaper form just get called.
+  virtual void compile(std::vector<trans_op>& ops, output_slot* target) {
+    ops.push_back({trans_op::OP_CALL, 0, 0, nullptr, this, target});
+  }
   
   //Do we want the input_source to send recurring "ticks" for processing?
   virtual bool wants_recurring_events() { return false; };
+  //If so, how many milliseconds apart.
+  virtual int recurring_period() const { return RECURRING_PERIOD_MS; };
+  //While this is false, ticks are skipped until the next input event.
+  virtual bool recurring_active() const { return true; };
 
 
   virtual ~event_translator() {};
@@ -88,6 +106,10 @@ public:
 
   //Do we want the input_source to send recurring "ticks" for processing?
   virtual bool wants_recurring_events() { return false; };
+  //If so, how many milliseconds apart.
+  virtual int recurring_period() const { return RECURRING_PERIOD_MS; };
+  //While this is false, ticks are skipped until the next input event.
+  virtual bool recurring_active() const { return true; };
 
   advanced_event_translator(std::vector<MGField>& fields) {};
   advanced_event_translator() {};
@@ -6,9 +6,24 @@ void multitrans::process(struct mg_ev ev, output_slot* out) {
     trans->process(ev, out);
 }
 
-void multitrans::process_recurring(output_slot* out) const {
+void multitrans::compile(std::vector<trans_op>& ops, output_slot* target) {
   for (auto trans : translist)
-    trans->process_recurring(out);
+    trans->compile(ops, target);
+}
+
+void multitrans::process_recurring(output_slot* out) const {
+  int period = recurring_period();
+  ms_owed.resize(translist.size(), 0);
+  for (int i = 0; i < translist.size(); i++) {
+    //Carry the surplus over, so a period that is not a multiple of ours
+    //still runs at the right rate on average, just with some jitter.
+    ms_owed[i] += period;
+    int trans_period = translist[i]->recurring_period();
+    if (ms_owed[i] < trans_period)
+      continue;
+    translist[i]->process_recurring(out);
+    ms_owed[i] -= trans_period;
+  }
 }
 
 void multitrans::attach(input_source* source) {
@@ -24,6 +39,26 @@ bool multitrans::wants_recurring_events() {
   return false;
 }
 
+int multitrans::recurring_period() const {
+  int period = 0;
+  for (auto trans : translist) {
+    if (!trans->wants_recurring_events())
+      continue;
+    int trans_period = trans->recurring_period();
+    if (period == 0 || trans_period < period)
+      period = trans_period;
+  }
+  return period > 0 ? period : RECURRING_PERIOD_MS;
+}
+
+bool multitrans::recurring_active() const {
+  for (auto trans : translist)
+    if (trans->wants_recurring_events() && trans->recurring_active())
+      return true;
+
+  return false;
+}
+
 const char* multitrans::decl = "event = multi(trans [])";
 multitrans::multitrans(std::vector<MGField>& fields) {
   BEGIN_READ_DEF;
@@ -13,9 +13,18 @@ public:
       delete trans;
   }
   virtual void process(struct mg_ev ev, output_slot* out);
+  virtual void compile(std::vector<trans_op>& ops, output_slot* target);
   virtual void process_recurring(output_slot* out) const;
   virtual void attach(input_source* source);
   virtual bool wants_recurring_events();
+  virtual int recurring_period() const;
+  virtual bool recurring_active() const;
+
+  //We tick at the shortest period of our translators. Each tick adds that much
+  //time to what every translator is owed, and one runs once it is owed its own period.
+  //Periods that are not a multiple of the shortest are only kept on average:
+  //with 7ms and 10ms translators, the 10ms one runs after 7 or 14ms.
+  mutable std::vector<int> ms_owed;
 
   virtual multitrans* clone() {
     return new multitrans(translist);
@@ -14,6 +14,11 @@ void redirect_trans::process(struct mg_ev ev, output_slot* out) {
 
 }
 
+void redirect_trans::compile(std::vector<trans_op>& ops, output_slot* target) {
+  trans->compile(ops, redirected);
+  ops.push_back({trans_op::OP_SYN, 0, 0, nullptr, this, redirected});
+}
+
 void redirect_trans::process_recurring(output_slot* out) const {
   trans->process_recurring(redirected);
   struct input_event out_ev;
@@ -32,6 +37,14 @@ bool redirect_trans::wants_recurring_events() {
   return trans->wants_recurring_events();
 }
 
+int redirect_trans::recurring_period() const {
+  return trans->recurring_period();
+}
+
+bool redirect_trans::recurring_active() const {
+  return trans->recurring_active();
+}
+
 const char* redirect_trans::decl = "event = redirect(trans, slot)";
 redirect_trans::redirect_trans(std::vector<MGField>& fields) {
   BEGIN_READ_DEF;
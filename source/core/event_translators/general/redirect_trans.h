@@ -15,9 +15,12 @@ public:
   }
 
   virtual void process(struct mg_ev ev, output_slot* out);
+  virtual void compile(std::vector<trans_op>& ops, output_slot* target);
   virtual void process_recurring(output_slot* out) const;
   virtual void attach(input_source* source);
   virtual bool wants_recurring_events();
+  virtual int recurring_period() const;
+  virtual bool recurring_active() const;
 
   virtual redirect_trans* clone() {
     return new redirect_trans(trans, redirected);
@@ -0,0 +1,31 @@
+#ifndef TRANS_OP_H
+#define TRANS_OP_H
+#include <stdint.h>
+
+class event_translator;
+class output_slot;
+
+//One step of a device's compiled mapping program.
+//
+//Whenever its mappings change, an input_source asks each translator to
+//compile itself into a flat list of these ops, run by a switch in
+//input_source::run_program. Common translators become plain ops, so the hot
+//path skips their virtual process() calls. Anything else compiles to OP_CALL.
+struct trans_op {
+  enum op_type : uint8_t {
+    OP_KEY,       //EV_KEY code, passing the value through
+    OP_ABS,       //EV_ABS code, value * arg clamped to +/-ABS_RANGE
+    OP_KEY_ABS,   //EV_ABS code, value * arg * ABS_RANGE
+    OP_KEY_BELOW, //EV_KEY code, pressed while value < -ABS_RANGE/2. Sent when *state changes.
+    OP_KEY_ABOVE, //EV_KEY code, pressed while value > ABS_RANGE/2. Sent when *state changes.
+    OP_SYN,       //SYN_REPORT
+    OP_CALL,      //call trans->process()
+  } type;
+  int code;
+  int arg;
+  int* state;
+  event_translator* trans;
+  output_slot* target; //nullptr for the device's own slot
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include "devices/generic/generic.h"
 #include "parser.h"
 #include "protocols/ostream_protocol.h"
+#include "claim_cache.h"
 
 //FUTURE WORK: Make it easier to specify additional virtpad styles.
 
@@ -71,6 +72,24 @@ std::vector<std::string> find_xdg_config_dirs(std::string commandline_override)
   return dirs;
 }
 
+//$XDG_CACHE_HOME/moltengamepad, created if needed. Empty if there is none.
+std::string locate_cache_dir() {
+  std::string cache_home;
+  const char* xdg_cache = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if (xdg_cache && *xdg_cache)
+    cache_home = std::string(xdg_cache);
+  else if (home && *home)
+    cache_home = std::string(home) + "/.cache";
+  else
+    return "";
+  mkdir(cache_home.c_str(), 0755);
+  std::string dir = cache_home + "/moltengamepad";
+  if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+    return "";
+  return dir;
+}
+
 std::string moltengamepad::locate(file_category cat, std::string path) {
   std::string commandline_override = "";
   std::string category_prefix = "";
@@ -193,6 +212,13 @@ const option_decl general_options[] = {
   {"enumerate", "Check for already connected devices", "true", MG_BOOL},
   {"monitor", "Listen for device connections/disconnections", "true", MG_BOOL},
   {"rumble", "Process controller rumble effects", "false", MG_BOOL},
+  {"device_batch_size", "Maximum number of ready files a device handles per wake up, sharing one SYN_REPORT", "16", MG_INT},
+  {"gendev_direct_read", "Let unsplit generic devices read their event nodes on their own thread, without a relay thread and pipe", "true", MG_BOOL},
+  {"shared_event_threads", "Handle all devices on a shared pool of threads instead of one thread per device", "false", MG_BOOL},
+  {"event_thread_count", "Number of threads in the shared pool. 0 uses one per CPU core", "0", MG_INT},
+  {"hotplug_coalesce_ms", "Milliseconds to gather device connections/disconnections, dropping those that cancel out, before handling them. 0 handles each at once", "0", MG_INT},
+  {"claim_cache", "Remember which driver claimed each device, to skip matching on the next start", "false", MG_BOOL},
+  {"enumerate_threads", "Number of threads that look up already connected devices at startup. They are still claimed in order", "1", MG_INT},
   {"", "", ""},
 };
 
@@ -341,11 +367,33 @@ int moltengamepad::init() {
     }
   }
 
+  //Devices need their event threads before udev starts adding them.
+  if (opts->get<bool>("shared_event_threads"))
+    engine = new event_engine(opts->get<int>("event_thread_count"));
+
   //start the udev thread
   udev.set_managers(&managers);
   udev.set_uinput(slots->get_uinput());
+  udev.set_coalesce_window(opts->get<int>("hotplug_coalesce_ms"));
   if (opts->get<bool>("monitor")) udev.start_monitor();
-  if (opts->get<bool>("enumerate"))   udev.enumerate();
+  if (opts->get<bool>("enumerate")) {
+    claim_cache* claims = nullptr;
+    std::string cache_dir = opts->get<bool>("claim_cache") ? locate_cache_dir() : "";
+    if (!cache_dir.empty()) {
+      //Cached claims are only good while the same drivers are loaded.
+      std::string signature;
+      for (auto man : managers)
+        signature += man->name + "\n";
+      for (auto path : gendev_files) {
+        struct stat filestat;
+        if (stat(path.c_str(), &filestat) == 0)
+          signature += path + " " + std::to_string(filestat.st_mtime) + " " + std::to_string(filestat.st_size) + "\n";
+      }
+      claims = new claim_cache(cache_dir + "/claims", signature);
+    }
+    udev.enumerate(opts->get<int>("enumerate_threads"), claims);
+    delete claims;
+  }
 
   //Finally start reading FIFO now that everything is up and running.
   if (opts->get<bool>("make_fifo")) {
@@ -391,6 +439,9 @@ moltengamepad::~moltengamepad() {
   //done first to protect from devices assuming their manager exists.
   devices.clear();
 
+  if (engine)
+    delete engine;
+
   //delete managers
   for (auto it = managers.begin(); it != managers.end(); ++it) {
     delete(*it);
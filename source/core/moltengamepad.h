@@ -17,6 +17,7 @@
 #include "profile.h"
 #include "plugin_loader.h"
 #include "protocols.h"
+#include "event_engine.h"
 
 #define VERSION_STRING "0.3.1-beta"
 
@@ -57,6 +58,7 @@ public:
   message_stream drivers;
   message_stream plugs;
   options* opts;
+  event_engine* engine = nullptr; //Only used if devices share event threads.
   std::shared_ptr<profile> gamepad = std::make_shared<profile>();
 
   moltengamepad(options* opts) : drivers("driver"), plugs("hotplug"), opts(opts) {};
@@ -0,0 +1,84 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+//A bounded, lock-free queue for many producers and a single consumer.
+//
+//Each cell carries a sequence number telling producers and the consumer
+//whose turn it is to use that cell. (This is Dmitry Vyukov's bounded queue,
+//with the consumer side simplified since only one thread ever pops.)
+//
+//T must be trivially copyable. push() fails instead of blocking when full.
+template <typename T>
+class mpsc_queue {
+public:
+  mpsc_queue(size_t min_capacity) {
+    size_t capacity = 2;
+    while (capacity < min_capacity)
+      capacity <<= 1;
+    mask = capacity - 1;
+    cells = new cell[capacity];
+    for (size_t i = 0; i < capacity; i++)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    head.store(0, std::memory_order_relaxed);
+    tail = 0;
+  }
+
+  ~mpsc_queue() {
+    delete[] cells;
+  }
+
+  mpsc_queue(const mpsc_queue&) = delete;
+  mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+  //Safe to call from any thread.
+  bool push(const T& item) {
+    size_t pos = head.load(std::memory_order_relaxed);
+    cell* c;
+    while (true) {
+      c = &cells[pos & mask];
+      size_t seq = c->seq.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false; //full
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+    c->data = item;
+    c->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  //Only one thread at a time may call this. Handing the consumer role to
+  //another thread needs its own synchronization (a mutex, or an atomic flag
+  //taken with acquire and released with release ordering).
+  bool pop(T& item) {
+    cell* c = &cells[tail & mask];
+    size_t seq = c->seq.load(std::memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(tail + 1) < 0)
+      return false; //empty, or a producer has not finished writing this cell.
+    item = c->data;
+    c->seq.store(tail + mask + 1, std::memory_order_release);
+    tail++;
+    return true;
+  }
+
+private:
+  struct cell {
+    std::atomic<size_t> seq;
+    T data;
+  };
+  cell* cells;
+  size_t mask;
+  std::atomic<size_t> head;
+  size_t tail;
+};
+
+#endif
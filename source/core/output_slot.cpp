@@ -3,6 +3,7 @@
 #include "devices/device.h"
 #include <linux/uinput.h>
 #include <csignal>
+#include <thread>
 
 output_slot::~output_slot() {
 }
@@ -18,12 +19,25 @@ bool output_slot::remove_device(input_source* dev) {
     }
     if (ptr.get() == dev) {
       devices.erase(it);
+      retire_producer(dev);
       return true;
     }
   }
   return false;
 }
 
+//Whatever dev left staged here will never be finished.
+//Its pools drop it when next used, possibly by a new producer at the same address.
+void output_slot::retire_producer(const void* dev) {
+  for (auto frame : frames) {
+    std::lock_guard<std::mutex> guard(frame->pools_lock);
+    for (auto pool : frame->pools) {
+      if (pool->producer == dev)
+        pool->retired = true;
+    }
+  }
+}
+
 bool output_slot::accept_device(std::shared_ptr<input_source> dev) {
   return true;
 }
@@ -37,22 +51,265 @@ bool output_slot::add_device(std::shared_ptr<input_source> dev) {
 }
 
 void output_slot::clear_outputs() {
-  //Could be optimized to only send events relevant to a device.
-  //This would require devices to keep lists of their relevant events.
-  struct input_event out_ev;
-  memset(&out_ev, 0, sizeof(out_ev));
-  out_ev.type = EV_KEY;
-  out_ev.value = 0;
-  for (out_ev.code = 0; out_ev.code < KEY_MAX; out_ev.code++)
-    take_event(out_ev);
-
-  out_ev.type = EV_ABS;
-  for (out_ev.code = 0; out_ev.code < ABS_MAX; out_ev.code++)
-    take_event(out_ev);
-
-  out_ev.type = EV_REL;
-  for (out_ev.code = 0; out_ev.code < REL_MAX; out_ev.code++)
-    take_event(out_ev);
+  for (auto frame : frames) {
+    if (aggregate) {
+      //An empty frame asks the writer to release whatever it has recorded as held.
+      submit_frame(*frame, {new std::vector<input_event>(), nullptr});
+    } else {
+      std::lock_guard<std::mutex> guard(frame_lock);
+      flush_frame(*frame);
+      write_releases(*frame);
+    }
+  }
+}
+
+void output_slot::set_aggregate(bool aggregate) {
+  if (this->aggregate.exchange(aggregate) == aggregate)
+    return;
+  for (auto frame : frames) {
+    if (aggregate) {
+      //Finish a partial frame now, before staged frames can overtake it.
+      std::lock_guard<std::mutex> guard(frame_lock);
+      flush_frame(*frame);
+    } else {
+      //Queued frames go out now. A partial frame staged by some thread is
+      //taken back by that thread along with its next event.
+      write_pending_frames(*frame);
+    }
+  }
+}
+
+void output_slot::set_max_frame_events(int max_events) {
+  std::lock_guard<std::mutex> guard(frame_lock);
+  max_frame_events = max_events < 1 ? 1 : max_events;
+}
+
+static std::atomic<uint64_t> next_frame_serial(1);
+
+output_slot::frame_buffer::frame_buffer() : serial(next_frame_serial++), pending(AGGREGATOR_QUEUE_SIZE), pending_count(0), writing(false), staged_pools(0) {
+  abs_values.fill(0);
+  abs_rest.fill(0);
+}
+
+output_slot::frame_buffer::~frame_buffer() {
+  staged_frame staged;
+  while (pending.pop(staged))
+    delete staged.events;
+  for (auto pool : pools)
+    delete pool;
+}
+
+output_slot::frame_pool::~frame_pool() {
+  std::vector<input_event>* events;
+  while (returned.pop(events))
+    delete events;
+  delete current;
+}
+
+//Only the thread owning this pool may call this.
+std::vector<input_event>* output_slot::frame_pool::take() {
+  std::vector<input_event>* events;
+  if (returned.pop(events))
+    return events;
+  events = new std::vector<input_event>();
+  events->reserve(DEFAULT_MAX_FRAME_EVENTS);
+  return events;
+}
+
+void output_slot::queue_event(frame_buffer& frame, const input_event& ev) {
+  if (aggregate) {
+    stage_event(frame, ev);
+    return;
+  }
+  std::lock_guard<std::mutex> guard(frame_lock);
+  if (frame.staged_pools > 0)
+    adopt_staged(frame);
+  frame.events.push_back(ev);
+  bool end_of_frame = ev.type == EV_SYN && ev.code == SYN_REPORT;
+  if (end_of_frame || frame.events.size() >= max_frame_events)
+    flush_frame(frame);
+}
+
+void output_slot::flush_frame(frame_buffer& frame) {
+  //called with frame_lock held.
+  if (frame.events.empty())
+    return;
+  write_frame(frame, frame.events);
+  frame.events.clear();
+}
+
+void output_slot::write_frame(frame_buffer& frame, std::vector<input_event>& events) {
+  if (frame.fd < 0 || events.empty())
+    return;
+  if (dedup) {
+    //Compact the frame in place, dropping key and axis events that repeat
+    //the last written value. Key autorepeats (value 2) always pass.
+    size_t kept = 0;
+    bool has_changes = false;
+    for (size_t i = 0; i < events.size(); i++) {
+      const input_event& ev = events[i];
+      bool repeat = false;
+      if (ev.type == EV_KEY && ev.code < KEY_CNT && (ev.value == 0 || ev.value == 1)) {
+        repeat = frame.keys_down[ev.code] == (ev.value != 0);
+        frame.keys_down[ev.code] = (ev.value != 0);
+      }
+      if (ev.type == EV_ABS && ev.code < ABS_CNT) {
+        repeat = frame.abs_values[ev.code] == ev.value;
+        frame.abs_values[ev.code] = ev.value;
+      }
+      if (repeat)
+        continue;
+      if (ev.type != EV_SYN)
+        has_changes = true;
+      events[kept++] = ev;
+    }
+    suppressed_events += events.size() - kept;
+    events.resize(kept);
+    //Nothing but SYN_REPORTs left, so the frame would be empty.
+    if (!has_changes)
+      return;
+  }
+  ssize_t ret = write(frame.fd, events.data(), events.size() * sizeof(input_event));
+  if (ret < 0) {
+    perror("write frame");
+    return;
+  }
+  if (dedup)
+    return; //state was already recorded above.
+  for (auto& ev : events) {
+    if (ev.type == EV_KEY && ev.code < KEY_CNT)
+      frame.keys_down[ev.code] = (ev.value != 0);
+    if (ev.type == EV_ABS && ev.code < ABS_CNT)
+      frame.abs_values[ev.code] = ev.value;
+  }
+}
+
+void output_slot::write_releases(frame_buffer& frame) {
+  std::vector<input_event> releases;
+  input_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.type = EV_KEY;
+  if (frame.keys_down.any()) {
+    for (int code = 0; code < KEY_CNT; code++) {
+      if (!frame.keys_down[code]) continue;
+      ev.code = code;
+      releases.push_back(ev);
+    }
+  }
+  ev.type = EV_ABS;
+  for (int code = 0; code < ABS_CNT; code++) {
+    if (frame.abs_values[code] == frame.abs_rest[code]) continue;
+    ev.code = code;
+    ev.value = frame.abs_rest[code];
+    releases.push_back(ev);
+  }
+  ev.value = 0;
+  if (releases.empty())
+    return;
+  ev.type = EV_SYN;
+  ev.code = SYN_REPORT;
+  releases.push_back(ev);
+  write_frame(frame, releases);
+}
+
+thread_local const void* output_slot::current_producer = nullptr;
+
+//The current producer's pool for frame, made on first use if create is set.
+output_slot::frame_pool* output_slot::producer_pool(frame_buffer& frame, bool create) {
+  //A producer stays on one thread and a thread only feeds a few frame_buffers,
+  //so a short thread-local list beats hashing. Serials are never reused, so
+  //entries for buffers that are gone do no harm.
+  static thread_local std::vector<std::pair<uint64_t, frame_pool*>> mine;
+  for (int i = 0; i < mine.size(); i++) {
+    if (mine[i].first != frame.serial || mine[i].second->producer != current_producer)
+      continue;
+    if (i > 0)
+      std::swap(mine[i], mine[0]); //Keep the busiest near the front.
+    frame_pool* pool = mine[0].second;
+    //A new producer may have been given the address of one that left.
+    if (pool->retired.exchange(false) && pool->current && !pool->current->empty()) {
+      pool->current->clear();
+      frame.staged_pools--;
+    }
+    return pool;
+  }
+  if (!create)
+    return nullptr;
+  //The frame_buffer owns the pool, so frames in flight can still return to it after we exit.
+  frame_pool* pool = new frame_pool(current_producer);
+  {
+    std::lock_guard<std::mutex> guard(frame.pools_lock);
+    frame.pools.push_back(pool);
+  }
+  mine.insert(mine.begin(), {frame.serial, pool});
+  return pool;
+}
+
+void output_slot::stage_event(frame_buffer& frame, const input_event& ev) {
+  frame_pool* pool = producer_pool(frame, true);
+  if (!pool->current)
+    pool->current = pool->take();
+  std::vector<input_event>& staged = *pool->current;
+  if (staged.empty())
+    frame.staged_pools++;
+  staged.push_back(ev);
+  bool end_of_frame = ev.type == EV_SYN && ev.code == SYN_REPORT;
+  //Oversized frames are handed off early, and so may be split.
+  if (!end_of_frame && staged.size() < max_frame_events)
+    return;
+
+  frame.staged_pools--;
+  submit_frame(frame, {pool->current, pool});
+  pool->current = nullptr;
+}
+
+//Aggregator mode was turned off while this producer had part of a frame staged.
+//Called with frame_lock held.
+void output_slot::adopt_staged(frame_buffer& frame) {
+  frame_pool* pool = producer_pool(frame, false);
+  if (!pool || !pool->current || pool->current->empty())
+    return;
+  frame.events.insert(frame.events.end(), pool->current->begin(), pool->current->end());
+  pool->current->clear();
+  frame.staged_pools--;
+}
+
+void output_slot::submit_frame(frame_buffer& frame, staged_frame complete) {
+  while (!frame.pending.push(complete)) {
+    //Queue is full. Help drain it, or let the current writer catch up.
+    write_pending_frames(frame);
+    std::this_thread::yield();
+  }
+  frame.pending_count++;
+  write_pending_frames(frame);
+}
+
+void output_slot::write_pending_frames(frame_buffer& frame) {
+  do {
+    //If another thread is writing, it will pick up our frame too.
+    if (frame.writing.exchange(true, std::memory_order_acquire))
+      return;
+    {
+      //Producers that saw aggregation off write under frame_lock, and one may
+      //still be doing so just after the mode changed. Only one writer at a
+      //time holds the flag, so this lock is normally uncontended.
+      std::lock_guard<std::mutex> guard(frame_lock);
+      staged_frame staged;
+      while (frame.pending.pop(staged)) {
+        frame.pending_count--;
+        if (staged.events->empty())
+          write_releases(frame);
+        else
+          write_frame(frame, *staged.events);
+        staged.events->clear();
+        if (!staged.pool || !staged.pool->returned.push(staged.events))
+          delete staged.events;
+      }
+    }
+    frame.writing.store(false, std::memory_order_release);
+    //A frame pushed after our last pop, whose producer saw us still writing,
+    //would otherwise be stranded.
+  } while (frame.pending_count > 0);
 }
 void noop_signal_handler(int signum) {
   //HACK: Assumes we only close_virt_device at the very end of process lifespan.
@@ -117,6 +374,12 @@ int output_slot::play_ff(int id, int repetitions) {
 }
 
 static std::string boolstrings[2] = {"false", "true"};
+
+//Scale a centered axis value to the 0-255 range of a trigger.
+static int32_t trigger_value(int64_t value) {
+  return (value + 32768) * 255 / (2 * 32768l);
+}
+
 virtual_gamepad::virtual_gamepad(std::string name, std::string descr, virtpad_settings settings, uinput* ui) : output_slot(name, descr) {
   this->dpad_as_hat = settings.dpad_as_hat;
   this->analog_triggers = settings.analog_triggers;
@@ -136,6 +399,12 @@ virtual_gamepad::virtual_gamepad(std::string name, std::string descr, virtpad_se
   options["facemap_1234"] = get_face_map();
   this->padstyle = settings;
   this->ui = ui;
+  pad_frame.fd = uinput_fd;
+  pad_frame.events.reserve(max_frame_events);
+  //Centered trigger axes rest where take_event puts a centered input.
+  pad_frame.abs_rest[ABS_Z] = trigger_value(0);
+  pad_frame.abs_rest[ABS_RZ] = trigger_value(0);
+  frames.push_back(&pad_frame);
 }
 
 virtual_keyboard::virtual_keyboard(std::string name, std::string descr, uinput_ids keyboard_ids, uinput_ids mouse_ids, uinput* ui) : output_slot(name, descr) {
@@ -151,16 +420,22 @@ virtual_keyboard::virtual_keyboard(std::string name, std::string descr, uinput_i
   
   this->u_ids = keyboard_ids;
   this->ui = ui;
+  key_frame.fd = uinput_fd;
+  key_frame.events.reserve(max_frame_events);
+  mouse_frame.fd = mouse_fd;
+  mouse_frame.events.reserve(max_frame_events);
+  frames.push_back(&key_frame);
+  frames.push_back(&mouse_frame);
 }
 
 void virtual_keyboard::take_event(struct input_event in) {
   //Relative events go to a separate mouse device.
   //SYN events should go to both!
   if (in.type == EV_REL || in.type == EV_SYN) {
-    write(mouse_fd, &in, sizeof(in));
+    queue_event(mouse_frame, in);
     if (in.type == EV_REL) return;
   }
-  write(uinput_fd, &in, sizeof(in));
+  queue_event(key_frame, in);
 };
 
 
@@ -180,11 +455,8 @@ void virtual_gamepad::take_event(struct input_event in) {
     if (in.code >= BTN_C) in.code--; //Skip BTN_C for computing the offset
     in.code = face_1234[in.code - BTN_SOUTH];
   }
-  if (in.type == EV_ABS && (in.code == ABS_Z || in.code == ABS_RZ)) {
-    int64_t value = (in.value + 32768) * 255;
-    value /= 2 * 32768l;
-    in.value = value;
-  }
+  if (in.type == EV_ABS && (in.code == ABS_Z || in.code == ABS_RZ))
+    in.value = trigger_value(in.value);
   if (analog_triggers && in.type == EV_KEY && in.code == BTN_TR2) {
     in.type = EV_ABS;
     in.code = ABS_RZ, in.value *= 255;
@@ -193,7 +465,7 @@ void virtual_gamepad::take_event(struct input_event in) {
     in.type = EV_ABS;
     in.code = ABS_Z,  in.value *= 255;
   }
-  write(uinput_fd, &in, sizeof(in));
+  queue_event(pad_frame, in);
 };
 
 bool virtual_gamepad::accept_device(std::shared_ptr<input_source> dev) {
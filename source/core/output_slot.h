@@ -7,8 +7,19 @@
 #include <string>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <array>
+#include <bitset>
+#include <functional>
+#include "mpsc_queue.h"
 
 #define OPTION_ACCEPTED 0
+//Events held back per uinput node before a frame is written early.
+#define DEFAULT_MAX_FRAME_EVENTS 64
+//Completed frames that may wait per uinput node in aggregator mode.
+#define AGGREGATOR_QUEUE_SIZE 64
 
 class input_source;
 
@@ -18,8 +29,8 @@ class output_slot {
 public:
   std::string name;
   std::string descr;
-  output_slot(std::string name) : name(name) { effects[0].id = -1;};
-  output_slot(std::string name, std::string descr) : name(name), descr(descr) {effects[0].id = -1;};
+  output_slot(std::string name) : name(name), aggregate(false), dedup(false), suppressed_events(0) { effects[0].id = -1;};
+  output_slot(std::string name, std::string descr) : name(name), descr(descr), aggregate(false), dedup(false), suppressed_events(0) {effects[0].id = -1;};
   virtual ~output_slot();
   virtual void take_event(struct input_event in) {
   }
@@ -41,8 +52,15 @@ public:
   virtual void clear_outputs();
   virtual void close_virt_device();
   void for_all_devices(std::function<void (std::shared_ptr<input_source>&)> func);
+  void set_max_frame_events(int max_events);
+  void set_aggregate(bool aggregate);
+  void set_dedup(bool dedup) { this->dedup = dedup; };
+  uint64_t get_suppressed_count() const { return suppressed_events; };
 
   int pad_count = 0;
+  //Whoever is sending events from this thread right now, usually an input_source.
+  //Aggregator mode stages frames separately per producer.
+  static thread_local const void* current_producer;
   std::map<std::string, std::string> options;
   slot_state state = SLOT_INACTIVE;
   ff_effect effects[1];
@@ -53,6 +71,64 @@ protected:
   bool device_opened = true;
   uinput* ui = nullptr;
 
+  //Events are held until a SYN_REPORT so a whole frame goes out in one write().
+  //
+  //In aggregator mode, each producer instead stages its own frame and
+  //pushes it whole onto a lock-free queue. Whichever producer wins the writing
+  //flag then writes out every queued frame, so frames from different devices
+  //sharing this slot never interleave.
+  //
+  //Each producer stages into its own frame_pool, even when several share a
+  //thread. Written frames are handed back to the pool they came from, so
+  //their vectors get reused.
+  struct frame_pool {
+    const void* const producer;
+    std::vector<input_event>* current = nullptr; //the frame being staged
+    mpsc_queue<std::vector<input_event>*> returned;
+    std::atomic<bool> retired; //producer left the slot, so current is stale
+    frame_pool(const void* producer) : producer(producer), returned(AGGREGATOR_QUEUE_SIZE), retired(false) {};
+    ~frame_pool();
+    std::vector<input_event>* take();
+  };
+  struct staged_frame {
+    std::vector<input_event>* events; //empty asks for a release of everything held
+    frame_pool* pool; //where events goes back to once written, if anywhere
+  };
+  struct frame_buffer {
+    int fd = -1;
+    std::vector<input_event> events;
+    const uint64_t serial; //identifies this buffer in thread-local staging
+    mpsc_queue<staged_frame> pending;
+    std::atomic<int> pending_count;
+    std::atomic<bool> writing;
+    std::mutex pools_lock;
+    std::vector<frame_pool*> pools; //one per producer and thread that ever staged here
+    std::atomic<int> staged_pools; //pools holding part of a frame
+    //What has been written so far, so clear_outputs only releases what is held.
+    //Only touched with frame_lock held, as is every write to fd.
+    std::bitset<KEY_CNT> keys_down;
+    std::array<int32_t, ABS_CNT> abs_values;
+    std::array<int32_t, ABS_CNT> abs_rest; //what clear_outputs sets each axis back to
+    frame_buffer();
+    ~frame_buffer();
+  };
+  std::mutex frame_lock;
+  int max_frame_events = DEFAULT_MAX_FRAME_EVENTS;
+  std::atomic<bool> aggregate;
+  std::atomic<bool> dedup; //drop events that would not change the written state
+  std::atomic<uint64_t> suppressed_events;
+  std::vector<frame_buffer*> frames; //every uinput node this slot writes to
+  void queue_event(frame_buffer& frame, const input_event& ev);
+  void flush_frame(frame_buffer& frame);
+  void write_frame(frame_buffer& frame, std::vector<input_event>& events);
+  void write_releases(frame_buffer& frame);
+  frame_pool* producer_pool(frame_buffer& frame, bool create);
+  void stage_event(frame_buffer& frame, const input_event& ev);
+  void adopt_staged(frame_buffer& frame);
+  void retire_producer(const void* dev);
+  void submit_frame(frame_buffer& frame, staged_frame complete);
+  void write_pending_frames(frame_buffer& frame);
+
   virtual int process_option(std::string name, std::string value) {
     return -1;
   };
@@ -84,6 +160,7 @@ protected:
   void set_face_map(std::string map);
   std::string get_face_map();
 
+  frame_buffer pad_frame;
 };
 
 class virtual_keyboard : public output_slot {
@@ -95,6 +172,8 @@ protected:
 
   uinput_ids u_ids;
   int mouse_fd = -1;
+  frame_buffer key_frame;
+  frame_buffer mouse_frame;
   virtual int process_option(std::string name, std::string value);
 };
 
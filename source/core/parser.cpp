@@ -884,6 +884,11 @@ bool MGparser::print_special_def(entry_type intype, MGTransDef& def, std::ostrea
           prefix = "+";
         }
       } else if (def.fields[0].type == MG_REL) {
+        //The shorthand has no way to give a tick rate.
+        if (def.fields.size() >= 3 && def.fields[2].type == MG_INT && def.fields[2].integer != RECURRING_PERIOD_MS)
+          return false;
+        if (def.fields.size() >= 4 && def.fields[3].type == MG_FLOAT && def.fields[3].real != 1)
+          return false;
         //Rel: default speeds depend on the intype as well!
         name = get_rel_name(def.fields[0].axis);
         int speed = def.fields[1].integer;
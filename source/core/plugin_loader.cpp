@@ -78,6 +78,10 @@ void init_plugin_api() {
     dev->watch_file(fd, tag);
     return 0;
   };
+  plugin_methods.device.unwatch_file = [] (input_source* dev, int fd) -> int {
+    dev->unwatch_file(fd);
+    return 0;
+  };
   plugin_methods.device.toggle_event = [] (input_source* dev, int id, event_state state) -> int {
     dev->toggle_event(id, state);
     return 0;
@@ -20,6 +20,9 @@ slot_manager::slot_manager(int max_pads, bool keys, const virtpad_settings& pads
   }
   opts.register_option({"active_pads","Number of virtpad slots currently active for assignment.", std::to_string(max_pads).c_str(), MG_INT});
   opts.register_option({"auto_assign","Assign devices to an output slot upon connection.", "false", MG_BOOL});
+  opts.register_option({"max_frame_events","Most events buffered for a virtual device before writing them without waiting for the end of the frame.", std::to_string(DEFAULT_MAX_FRAME_EVENTS).c_str(), MG_INT});
+  opts.register_option({"dedup_events","Drop key and axis events that repeat the value last sent to a virtual device.", "false", MG_BOOL});
+  opts.register_option({"aggregate_frames","Have devices sharing a slot queue whole frames to a single writer, so their events never interleave.", "false", MG_BOOL});
 
   if (padstyle.rumble)
     ui->start_ff_thread();
@@ -141,6 +144,24 @@ int slot_manager::process_option(std::string& name, MGField value) {
     }
     return 0;
   }
+  if (name == "max_frame_events" && value.integer >= 1) {
+    for (auto slot : slots)
+      slot->set_max_frame_events(value.integer);
+    keyboard->set_max_frame_events(value.integer);
+    return 0;
+  }
+  if (name == "dedup_events") {
+    for (auto slot : slots)
+      slot->set_dedup(value.boolean);
+    keyboard->set_dedup(value.boolean);
+    return 0;
+  }
+  if (name == "aggregate_frames") {
+    for (auto slot : slots)
+      slot->set_aggregate(value.boolean);
+    keyboard->set_aggregate(value.boolean);
+    return 0;
+  }
 
   return -1;
 }
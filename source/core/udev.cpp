@@ -3,11 +3,13 @@
 #include <sys/epoll.h>
 #include <cstring>
 #include <unistd.h>
+#include <time.h>
 #include <sys/stat.h>
-#include <glob.h>
 #include <algorithm>
+#include <atomic>
 #include "devices/device.h"
 #include "uinput.h"
+#include "claim_cache.h"
 
 struct deferred_claim {
   device_manager* manager;
@@ -18,18 +20,19 @@ bool claim_cmp (const deferred_claim& a, const deferred_claim& b) {
   return a.order < b.order;
 }
 
-void udev_handler::pass_along_device(struct udev_device* new_dev) {
-  if (new_dev == nullptr) return;
+//Returns the manager that ended up claiming the device, if any.
+device_manager* udev_handler::pass_along_device(struct udev_device* new_dev) {
+  if (new_dev == nullptr) return nullptr;
   std::vector<deferred_claim> deferred;
   std::lock_guard<std::mutex> lock(manager_lock);
-  if (managers == nullptr) return;
+  if (managers == nullptr) return nullptr;
   std::string path(udev_device_get_syspath(new_dev));
   const char* action = udev_device_get_action(new_dev);
   if (!action) action = "enumerated";
   debug_print(DEBUG_INFO, 4, "device ",action," ",path.c_str());
   if (ui && ui->node_owned(path)) {
     debug_print(DEBUG_VERBOSE, 1, "\tskipped because it was made by MoltenGamepad");
-    return; //Skip virtual devices we made
+    return nullptr; //Skip virtual devices we made
   }
 
   //Give each manager a chance to claim the device.
@@ -39,14 +42,14 @@ void udev_handler::pass_along_device(struct udev_device* new_dev) {
     int ret = man->accept_device(udev, new_dev);
     if (ret == DEVICE_CLAIMED) {
       debug_print(DEBUG_INFO, 2, "\tclaimed by manager ",man->name.c_str());
-      return;
+      return man;
     }
     if (ret == DEVICE_UNCLAIMED || ret < 0) continue;
     debug_print(DEBUG_INFO, 4, "\tclaimed by manager ",man->name.c_str(), ", order = ", std::to_string(ret+1).c_str());
     deferred.push_back({man, ret});
   }
   if (deferred.empty())
-    return; //no claims, no deferred claims.
+    return nullptr; //no claims, no deferred claims.
 
   //use stable sort so that the normal ordering still applies.
   std::stable_sort(deferred.begin(), deferred.end(), claim_cmp);
@@ -54,15 +57,38 @@ void udev_handler::pass_along_device(struct udev_device* new_dev) {
     int ret = claim.manager->accept_deferred_device(udev, new_dev);
     if (ret == DEVICE_CLAIMED)  {
       debug_print(DEBUG_INFO, 2, "\tultimately claimed by manager ", claim.manager->name.c_str());
-      break;
+      return claim.manager;
     } else {
       debug_print(DEBUG_INFO, 3, "\trejected by manager ", claim.manager->name.c_str(), ", despite previous claim");
     }
   }
-
+  return nullptr;
 }
 
-
+//Offer the device only to the manager that claimed it last time.
+//Returns false if the full search is still needed.
+bool udev_handler::pass_along_cached(struct udev_device* dev, const std::string& manager_name) {
+  std::lock_guard<std::mutex> lock(manager_lock);
+  if (managers == nullptr) return false;
+  const char* path = udev_device_get_syspath(dev);
+  if (manager_name.empty()) {
+    debug_print(DEBUG_INFO, 3, "device ", path, " skipped, cached as unclaimed");
+    return true;
+  }
+  for (auto man : *managers) {
+    if (man->name != manager_name)
+      continue;
+    int ret = man->accept_device(udev, dev);
+    if (ret > DEVICE_CLAIMED)
+      ret = man->accept_deferred_device(udev, dev);
+    if (ret == DEVICE_CLAIMED) {
+      debug_print(DEBUG_INFO, 4, "device ", path, " claimed by cached manager ", man->name.c_str());
+      return true;
+    }
+    break;
+  }
+  return false;
+}
 
 udev_handler::udev_handler() {
   udev = udev_new();
@@ -91,7 +117,14 @@ udev_handler::~udev_handler() {
     }
   }
   grabbed_nodes.clear();
+  for (auto entry : js_nodes) {
+    for (auto node : entry.second)
+      udev_device_unref(node);
+  }
+  js_nodes.clear();
   if (monitor) udev_monitor_unref(monitor);
+  for (auto context : enumerate_contexts)
+    udev_unref(context);
   if (udev) udev_unref(udev);
 }
 
@@ -104,6 +137,10 @@ void udev_handler::set_uinput(const uinput* ui) {
   this->ui = ui;
 }
 
+void udev_handler::set_coalesce_window(int ms) {
+  coalesce_ms = ms;
+}
+
 int udev_handler::start_monitor() {
   monitor = udev_monitor_new_from_netlink(udev, "udev");
   udev_monitor_filter_add_match_subsystem_devtype(monitor, "hid", NULL);
@@ -115,7 +152,24 @@ int udev_handler::start_monitor() {
   return 0;
 }
 
-int udev_handler::enumerate() {
+//Look up what managers usually check when claiming a device,
+//so that libudev already has it cached in the device.
+void prefetch_device(struct udev_device* dev) {
+  udev_device_get_properties_list_entry(dev);
+  udev_device_get_parent_with_subsystem_devtype(dev, "hid", NULL);
+  struct udev_device* parent = udev_device_get_parent(dev);
+  if (parent) {
+    udev_device_get_sysattr_value(parent, "name");
+    udev_device_get_sysattr_value(parent, "capabilities/abs");
+    udev_device_get_sysattr_value(parent, "capabilities/key");
+  }
+  for (struct udev_device* ancestor = dev; ancestor; ancestor = udev_device_get_parent(ancestor)) {
+    udev_device_get_properties_list_entry(ancestor);
+    udev_device_get_driver(ancestor);
+  }
+}
+
+int udev_handler::enumerate(int threads, claim_cache* claims) {
   struct udev_enumerate* enumerate = udev_enumerate_new(udev);
   udev_enumerate_add_match_subsystem(enumerate, "hid");
   udev_enumerate_add_match_subsystem(enumerate, "input");
@@ -124,15 +178,62 @@ int udev_handler::enumerate() {
 
   struct udev_list_entry* devices = udev_enumerate_get_list_entry(enumerate);
   struct udev_list_entry* entry;
+  std::vector<std::string> paths;
 
   udev_list_entry_foreach(entry, devices) {
-    const char* path = udev_list_entry_get_name(entry);
-    struct udev_device* dev = udev_device_new_from_syspath(udev, path);
-    pass_along_device(dev);
+    paths.push_back(udev_list_entry_get_name(entry));
+  }
+  udev_enumerate_unref(enumerate);
+
+  //Reading sysfs and the udev database for each device is the slow part,
+  //so that can be done by several threads up front. libudev is not thread safe,
+  //so each thread gets its own context.
+  std::vector<struct udev_device*> found(paths.size(), nullptr);
+  if (threads > 1 && paths.size() > 1) {
+    std::atomic<size_t> next(0);
+    std::vector<std::thread*> workers;
+    for (int i = 0; i < threads && i < paths.size(); i++) {
+      struct udev* context = udev_new();
+      if (!context)
+        break;
+      enumerate_contexts.push_back(context);
+      workers.push_back(new std::thread([&paths, &found, &next, context] () {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+          found[i] = udev_device_new_from_syspath(context, paths[i].c_str());
+          if (found[i])
+            prefetch_device(found[i]);
+        }
+      }));
+    }
+    for (auto worker : workers) {
+      worker->join();
+      delete worker;
+    }
+  }
+
+  //Claims still happen one at a time and in the usual order,
+  //so devices get the same names and slots as before.
+  for (size_t i = 0; i < paths.size(); i++) {
+    struct udev_device* dev = found[i];
+    if (!dev)
+      dev = udev_device_new_from_syspath(udev, paths[i].c_str());
+    if (!dev)
+      continue;
+    note_node(dev);
+    std::string cached;
+    if (claims && claims->lookup(dev, cached) && pass_along_cached(dev, cached)) {
+      claims->record(dev, cached);
+    } else {
+      device_manager* claimer = pass_along_device(dev);
+      if (claims)
+        claims->record(dev, claimer ? claimer->name : "");
+    }
     udev_device_unref(dev);
   }
 
-  udev_enumerate_unref(enumerate);
+  if (claims && !claims->save())
+    debug_print(DEBUG_INFO, 1, "claim cache: could not be written");
+
   return 0;
 }
 
@@ -158,8 +259,33 @@ int udev_handler::read_monitor() {
   pipe_fd = pipes[1];
 
 
+  //Connecting one device can set off a burst of events for its various nodes.
+  //With a coalescing window, we gather them up, drop those that cancel out,
+  //then hand the rest to the managers one by one, in order.
+  std::vector<struct udev_device*> batch;
+  struct timespec batch_start;
+
   while (!stop_thread) {
-    int n = epoll_wait(epfd, events, EPOLL_MAX_EVENTS, -1);
+    int timeout = -1;
+    if (!batch.empty()) {
+      struct timespec now;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      int elapsed = (now.tv_sec - batch_start.tv_sec) * 1000 + (now.tv_nsec - batch_start.tv_nsec) / 1000000;
+      if (elapsed >= coalesce_ms) {
+        //The window closed. Flush now even if more events keep arriving,
+        //or a steady stream of them would hold up the batch forever.
+        for (auto dev : batch) {
+          handle_monitor_device(dev);
+          udev_device_unref(dev);
+        }
+        batch.clear();
+        continue;
+      }
+      timeout = coalesce_ms - elapsed;
+    }
+    int n = epoll_wait(epfd, events, EPOLL_MAX_EVENTS, timeout);
+    if (n <= 0)
+      continue;
     if (!events[0].data.ptr) {
       char buffer[2];
       int ret = 1;
@@ -167,20 +293,119 @@ int udev_handler::read_monitor() {
     } else {
       struct udev_device* dev = udev_monitor_receive_device(monitor);
       if (dev) {
-        pass_along_device(dev);
-        const char* action = udev_device_get_action(dev);
-        if (!strcmp(action, "remove")) {
-          grab_permissions(dev, false);
+        if (coalesce_ms <= 0) {
+          handle_monitor_device(dev);
+          udev_device_unref(dev);
+        } else {
+          if (batch.empty())
+            clock_gettime(CLOCK_MONOTONIC, &batch_start);
+          add_to_batch(batch, dev);
         }
-        udev_device_unref(dev);
       }
     }
   }
+  for (auto dev : batch)
+    udev_device_unref(dev);
   std::cout << "stopping udev thread" << std::endl;
 
   return 0;
 }
 
+void udev_handler::handle_monitor_device(struct udev_device* dev) {
+  note_node(dev);
+  pass_along_device(dev);
+  const char* action = udev_device_get_action(dev);
+  if (action && !strcmp(action, "remove")) {
+    grab_permissions(dev, false);
+  }
+}
+
+//Takes ownership of dev.
+void udev_handler::add_to_batch(std::vector<struct udev_device*>& batch, struct udev_device* dev) {
+  const char* action = udev_device_get_action(dev);
+  const char* path = udev_device_get_syspath(dev);
+  if (action && path && !strcmp(action, "remove")) {
+    //If this device was added within the window, no one needs to hear about either.
+    for (int i = batch.size() - 1; i >= 0; i--) {
+      const char* prev_action = udev_device_get_action(batch[i]);
+      if (!prev_action || strcmp(path, udev_device_get_syspath(batch[i])))
+        continue;
+      if (strcmp(prev_action, "add"))
+        continue;
+      //Drop the add along with anything that happened to the device since.
+      for (int j = batch.size() - 1; j >= i; j--) {
+        if (!strcmp(path, udev_device_get_syspath(batch[j]))) {
+          udev_device_unref(batch[j]);
+          batch.erase(batch.begin() + j);
+        }
+      }
+      udev_device_unref(dev);
+      return;
+    }
+  }
+  batch.push_back(dev);
+}
+
+//Caller must hold grabbed_nodes_lock.
+void udev_handler::grab_node(grabbed_node& grabbed, udev_device* dev) {
+  const char* devnode = udev_device_get_devnode(dev);
+  if (!devnode)
+    return;
+  //Grabbing twice would record the already cleared mode as the original.
+  for (auto& child : grabbed.children) {
+    const char* child_devnode = udev_device_get_devnode(child.node);
+    if (child_devnode && !strcmp(child_devnode, devnode))
+      return;
+  }
+  struct stat filestat;
+  stat(devnode, &filestat);
+  node_permissions node;
+  node.node = udev_device_ref(dev);
+  node.orig_mode = filestat.st_mode;
+  grabbed.children.push_back(node);
+  chmod(devnode, 0);
+}
+
+void udev_handler::note_node(udev_device* dev) {
+  const char* sysname = udev_device_get_sysname(dev);
+  const char* subsystem = udev_device_get_subsystem(dev);
+  const char* syspath = udev_device_get_syspath(dev);
+  if (!sysname || !subsystem || !syspath)
+    return;
+  if (strncmp(sysname, "js", 2) || strcmp(subsystem, "input"))
+    return;
+  //Take the parent from the path, as it may already be gone on removal.
+  std::string path(syspath);
+  std::string parentpath = path.substr(0, path.rfind('/'));
+  const char* action = udev_device_get_action(dev);
+  bool removed = action && !strcmp(action, "remove");
+
+  std::lock_guard<std::mutex> guard(grabbed_nodes_lock);
+  auto& nodes = js_nodes[parentpath];
+  for (auto it = nodes.begin(); it != nodes.end(); it++) {
+    if (path == udev_device_get_syspath(*it)) {
+      udev_device_unref(*it);
+      nodes.erase(it);
+      break;
+    }
+  }
+  if (removed) {
+    if (nodes.empty())
+      js_nodes.erase(parentpath);
+    return;
+  }
+  nodes.push_back(udev_device_ref(dev));
+
+  //If a sibling node was already grabbed, this one should be as well.
+  for (auto& entry : grabbed_nodes) {
+    if (entry.second.children.empty())
+      continue;
+    std::string basepath(udev_device_get_syspath(entry.second.children.front().node));
+    if (basepath.substr(0, basepath.rfind('/')) == parentpath)
+      grab_node(entry.second, dev);
+  }
+}
+
 int udev_handler::grab_permissions(udev_device* dev, bool grabbed) {
   std::lock_guard<std::mutex> guard(grabbed_nodes_lock);
   const char* devnode = udev_device_get_devnode(dev);
@@ -191,36 +416,20 @@ int udev_handler::grab_permissions(udev_device* dev, bool grabbed) {
     //We need to do the grabbing!
     if (grabbed_nodes.find(devnodepath) != grabbed_nodes.end())
       return FAILURE;
-    struct stat filestat;
-    stat(devnode, &filestat);
-    node_permissions base_node;
-    base_node.node = udev_device_ref(dev);
-    base_node.orig_mode = filestat.st_mode;
-    grabbed_nodes[devnodepath].children.push_back(base_node);
-    chmod(devnode, 0);
+    grabbed_node& grabbed_entry = grabbed_nodes[devnodepath];
+    grab_node(grabbed_entry, dev);
 
     //This device might have a js device we also want to grab...
     auto parent = udev_device_get_parent(dev);
-    std::string parentpath(udev_device_get_syspath(parent));
-    parentpath += "/js[0-9]*";
-    glob_t globbuffer;
-    glob(parentpath.c_str(), 0, nullptr, &globbuffer);
-
-    for (int i = 0; i < globbuffer.gl_pathc; i++) {
-      udev_device* subdev = udev_device_new_from_syspath(udev, globbuffer.gl_pathv[i]);
-      if (!subdev)
-        continue;
-      devnode = udev_device_get_devnode(subdev);
-      stat(devnode, &filestat);
-      node_permissions sub_node;
-      sub_node.node = udev_device_ref(subdev);
-      sub_node.orig_mode = filestat.st_mode;
-      grabbed_nodes[devnodepath].children.push_back(sub_node);
-      chmod(devnode, 0);
-      udev_device_unref(subdev);
+    const char* parentpath = parent ? udev_device_get_syspath(parent) : nullptr;
+    if (parentpath) {
+      auto it = js_nodes.find(parentpath);
+      if (it != js_nodes.end()) {
+        for (auto subdev : it->second)
+          grab_node(grabbed_entry, subdev);
+      }
     }
 
-    globfree(&globbuffer);
     return SUCCESS;
   } else {
     //Undo the grabbing!
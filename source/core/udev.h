@@ -9,6 +9,7 @@
 
 class device_manager;
 class uinput;
+class claim_cache;
 
 struct node_permissions {
   udev_device* node;
@@ -29,22 +30,35 @@ public:
   std::thread* monitor_thread;
   volatile bool stop_thread = false;
   int pipe_fd;
+  int coalesce_ms = 0; //how long the monitor gathers events before handing them out
 
   udev_handler();
   ~udev_handler();
 
   void set_managers(std::vector<device_manager*>* managers);
   void set_uinput(const uinput* ui);
-  int enumerate();
+  void set_coalesce_window(int ms);
+  int enumerate(int threads, claim_cache* claims);
   int start_monitor();
   int udev_fd();
   int read_monitor();
   int grab_permissions(udev_device* dev, bool grabbed);
+  //Keep the joystick node index up to date with this add/remove.
+  void note_node(udev_device* dev);
 private:
-  void pass_along_device(struct udev_device* new_dev);
+  device_manager* pass_along_device(struct udev_device* new_dev);
+  bool pass_along_cached(struct udev_device* dev, const std::string& manager_name);
+  void handle_monitor_device(struct udev_device* dev);
+  void add_to_batch(std::vector<struct udev_device*>& batch, struct udev_device* dev);
   std::mutex manager_lock;
   std::mutex grabbed_nodes_lock;
   std::unordered_map<std::string,grabbed_node> grabbed_nodes;
+  //Parent syspath -> referenced jsX nodes under it, as seen in udev events.
+  //Lets grabbing find a node's joystick siblings without scanning sysfs.
+  std::unordered_map<std::string,std::vector<udev_device*>> js_nodes;
+  void grab_node(grabbed_node& grabbed, udev_device* dev);
+  //Contexts used by enumeration threads. Devices made from them may be kept around.
+  std::vector<struct udev*> enumerate_contexts;
 };
 
 
@@ -74,6 +74,8 @@ struct device_methods {
   int (*remove_option) (input_source* dev, const char* opname);
   //Print a message labelled as coming from this device.
   int (*print) (input_source*, const char* message);
+  //Stop watching a file descriptor previously given to watch_file.
+  int (*unwatch_file) (input_source* dev, int fd);
 };
 
 struct device_plugin {
@@ -110,6 +112,10 @@ struct device_plugin {
   int (*erase_ff) (void* plug_data, int id);
   //Called to activate a previously uploaded effect.
   int (*play_ff) (void* plug_data, int id, int repeats);
+  //Called when the set of events that matter changes, e.g. after a mapping change.
+  //wanted[id] is zero if event id is currently mapped to nothing.
+  //The plugin may use this to stop the kernel from sending such events at all.
+  int (*update_event_mask) (void* plug_data, int count, const unsigned char* wanted);
 };
 
 struct manager_methods {
@@ -105,251 +105,317 @@ const option_decl wiimote_options[] = {
 
 
 
-void wiimote::process_core() {
-  struct input_event ev;
-  int ret;
-  while (ret = read(buttons.fd, &ev, sizeof(ev)) > 0) {
-    int offset = 0;
-
-    if (mode == NUNCHUK_EXT) offset = nk_a;
-    if (ret > 0) {
-      switch (ev.code) {
-      case KEY_LEFT:
-        send_value(offset + wm_left, ev.value);
-        break;
-      case KEY_RIGHT:
-        send_value(offset + wm_right, ev.value);
-        break;
-      case KEY_UP:
-        send_value(offset + wm_up, ev.value);
-        break;
-      case KEY_DOWN:
-        send_value(offset + wm_down, ev.value);
-        break;
-      case BTN_A:
-        send_value(offset + wm_a, ev.value);
-        break;
-      case BTN_B:
-        send_value(offset + wm_b, ev.value);
-        break;
-      case BTN_1:
-        send_value(offset + wm_1, ev.value);
-        break;
-      case BTN_2:
-        send_value(offset + wm_2, ev.value);
-        break;
-      case KEY_PREVIOUS:
-        send_value(offset + wm_minus, ev.value);
-        break;
-      case KEY_NEXT:
-        send_value(offset + wm_plus, ev.value);
-        break;
-      case BTN_MODE:
-        send_value(offset + wm_home, ev.value);
-        break;
-      case SYN_REPORT:
-        methods.send_syn_report(ref);
-      }
-    }
-  }
-  if (ret < 0) perror("read core");
-
-};
+static inline bool test_bit(const uint8_t* bits, int bit) {
+  return bits[bit / 8] & (1 << (bit % 8));
+}
 
-#define CLASSIC_STICK_SCALE ABS_RANGE/24
-void wiimote::process_classic(int fd) {
-  struct input_event ev;
-  int ret = read(fd, &ev, sizeof(ev));
-  if (ret > 0) {
-
-    if (ev.type == EV_KEY) switch (ev.code) {
-      case KEY_LEFT:
-        send_value(cc_left, ev.value);
-        break;
-      case KEY_RIGHT:
-        send_value(cc_right, ev.value);
-        break;
-      case KEY_UP:
-        send_value(cc_up, ev.value);
-        break;
-      case KEY_DOWN:
-        send_value(cc_down, ev.value);
-        break;
-      case BTN_A:
-        send_value(cc_a, ev.value);
-        break;
-      case BTN_B:
-        send_value(cc_b, ev.value);
-        break;
-      case BTN_X:
-        send_value(cc_x, ev.value);
-        break;
-      case BTN_Y:
-        send_value(cc_y, ev.value);
-        break;
-      case KEY_PREVIOUS:
-        send_value(cc_minus, ev.value);
-        break;
-      case KEY_NEXT:
-        send_value(cc_plus, ev.value);
-        break;
-      case BTN_MODE:
-        send_value(cc_home, ev.value);
-        break;
-      case BTN_TL:
-        send_value(cc_l, ev.value);
-        break;
-      case BTN_TR:
-        send_value(cc_r, ev.value);
-        break;
-      case BTN_TL2:
-        send_value(cc_zl, ev.value);
-        break;
-      case BTN_TR2:
-        send_value(cc_zr, ev.value);
-        break;
+//Read everything waiting on a node, handing each event to the handler.
+//After a SYN_DROPPED, events are discarded up to the next SYN_REPORT. Then the
+//node's current key and axis state is fed to the handler instead, followed by
+//a SYN_REPORT. send_value ignores unchanged values, so only differences go out.
+//Returns the errno that ended reading, or 0.
+int wiimote::read_node(struct dev_node* node, void (wiimote::*handler)(const input_event&)) {
+  struct input_event evs[WII_READ_BATCH];
+  ssize_t ret;
+  while ((ret = read(node->fd, evs, sizeof(evs))) > 0) {
+    int count = ret / sizeof(struct input_event);
+    for (int i = 0; i < count; i++) {
+      const input_event& ev = evs[i];
+      if (ev.type == EV_SYN && ev.code == SYN_DROPPED) {
+        node->dropped = true;
+        continue;
       }
-    else if (ev.type == EV_ABS) switch (ev.code) {
-      case ABS_HAT1X:
-        send_value(cc_left_x, ev.value * CLASSIC_STICK_SCALE);
-        break;
-      case ABS_HAT1Y:
-        send_value(cc_left_y, -ev.value * CLASSIC_STICK_SCALE);
-        break;
-      case ABS_HAT2X:
-        send_value(cc_right_x, ev.value * CLASSIC_STICK_SCALE);
-        break;
-      case ABS_HAT2Y:
-        send_value(cc_right_y, -ev.value * CLASSIC_STICK_SCALE);
-        break;
+      if (node->dropped) {
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+          node->dropped = false;
+          resync_node(node, handler);
+        }
+        continue;
       }
-    else {
-      methods.send_syn_report(ref);
+      (this->*handler)(ev);
     }
-
-  }
-  if (ret < 0 && errno == ENODEV) {
-    close(fd);
-    classic.fd = -1;
-    return;
+    if (ret < sizeof(evs))
+      return 0; //Short read: nothing more is waiting right now.
   }
-  if (ret < 0) perror("read classic ext");
+  return (ret < 0) ? errno : 0;
 }
 
-#define NUNCHUK_STICK_SCALE ABS_RANGE/24
-#define NUNCHUK_ACCEL_SCALE ABS_RANGE/90
-void wiimote::process_nunchuk(int fd) {
+void wiimote::resync_node(struct dev_node* node, void (wiimote::*handler)(const input_event&)) {
   struct input_event ev;
-  int ret = read(fd, &ev, sizeof(ev));
-  if (ret > 0) {
-
-    if (ev.type == EV_KEY) switch (ev.code) {
-      case BTN_C:
-        send_value(nk_c, ev.value);
-        break;
-      case BTN_Z:
-        send_value(nk_z, ev.value);
-        break;
-      }
-    else if (ev.type == EV_ABS) switch (ev.code) {
-      case ABS_HAT0X:
-        send_value(nk_stick_x, ev.value * NUNCHUK_STICK_SCALE);
-        break;
-      case ABS_HAT0Y:
-        send_value(nk_stick_y, -ev.value * NUNCHUK_STICK_SCALE);
-        break;
-      case ABS_RX:
-        send_value(nk_accel_x, ev.value * NUNCHUK_ACCEL_SCALE);
-        break;
-      case ABS_RY:
-        send_value(nk_accel_y, ev.value * NUNCHUK_ACCEL_SCALE);
-        break;
-      case ABS_RZ:
-        send_value(nk_accel_z, ev.value * NUNCHUK_ACCEL_SCALE);
-        break;
-      }
-    else {
-      methods.send_syn_report(ref);
+  memset(&ev, 0, sizeof(ev));
+
+  uint8_t key_bits[KEY_CNT / 8 + 1];
+  uint8_t key_state[KEY_CNT / 8 + 1];
+  memset(key_bits, 0, sizeof(key_bits));
+  memset(key_state, 0, sizeof(key_state));
+  if (ioctl(node->fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits) >= 0 &&
+      ioctl(node->fd, EVIOCGKEY(sizeof(key_state)), key_state) >= 0) {
+    ev.type = EV_KEY;
+    for (int code = 0; code < KEY_CNT; code++) {
+      if (!test_bit(key_bits, code)) continue;
+      ev.code = code;
+      ev.value = test_bit(key_state, code) ? 1 : 0;
+      (this->*handler)(ev);
     }
   }
-  if (ret < 0 && errno == ENODEV) {
-    close(fd);
-    nunchuk.fd = -1;
-    return;
+
+  uint8_t abs_bits[ABS_CNT / 8 + 1];
+  memset(abs_bits, 0, sizeof(abs_bits));
+  if (ioctl(node->fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits) >= 0) {
+    ev.type = EV_ABS;
+    for (int code = 0; code < ABS_CNT; code++) {
+      input_absinfo info;
+      if (!test_bit(abs_bits, code) || ioctl(node->fd, EVIOCGABS(code), &info) < 0)
+        continue;
+      ev.code = code;
+      ev.value = info.value;
+      (this->*handler)(ev);
+    }
   }
-  if (ret < 0) perror("read nunchuk");
+
+  ev.type = EV_SYN;
+  ev.code = SYN_REPORT;
+  ev.value = 0;
+  (this->*handler)(ev);
 }
 
-#define WIIMOTE_ACCEL_SCALE ABS_RANGE/90
-void wiimote::process_accel(int fd) {
-  struct input_event ev;
-  int ret;
-  while (ret = read(fd, &ev, sizeof(ev)) > 0) {
-    int offset = 0;
-
-    if (mode == NUNCHUK_EXT) {
-      offset = nk_wm_accel_x;
-    } else {
-      offset = wm_accel_x;
-    }
-    if (ret > 0) {
-      switch (ev.code) {
-      case ABS_RX:
-        send_value(offset + 0, ev.value * WIIMOTE_ACCEL_SCALE);
-        break;
-      case ABS_RY:
-        send_value(offset + 1, ev.value * WIIMOTE_ACCEL_SCALE);
-        break;
-      case ABS_RZ:
-        send_value(offset + 2, ev.value * WIIMOTE_ACCEL_SCALE);
-        break;
-      case SYN_REPORT:
-        methods.send_syn_report(ref);
-      }
-    }
+void wiimote::process_core() {
+  int err = read_node(&buttons, &wiimote::core_event);
+  if (err && err != EAGAIN) perror("read core");
+}
+
+void wiimote::core_event(const input_event& ev) {
+  int offset = 0;
+
+  if (mode == NUNCHUK_EXT) offset = nk_a;
+  switch (ev.code) {
+  case KEY_LEFT:
+    send_value(offset + wm_left, ev.value);
+    break;
+  case KEY_RIGHT:
+    send_value(offset + wm_right, ev.value);
+    break;
+  case KEY_UP:
+    send_value(offset + wm_up, ev.value);
+    break;
+  case KEY_DOWN:
+    send_value(offset + wm_down, ev.value);
+    break;
+  case BTN_A:
+    send_value(offset + wm_a, ev.value);
+    break;
+  case BTN_B:
+    send_value(offset + wm_b, ev.value);
+    break;
+  case BTN_1:
+    send_value(offset + wm_1, ev.value);
+    break;
+  case BTN_2:
+    send_value(offset + wm_2, ev.value);
+    break;
+  case KEY_PREVIOUS:
+    send_value(offset + wm_minus, ev.value);
+    break;
+  case KEY_NEXT:
+    send_value(offset + wm_plus, ev.value);
+    break;
+  case BTN_MODE:
+    send_value(offset + wm_home, ev.value);
+    break;
+  case SYN_REPORT:
+    methods.send_syn_report(ref);
   }
-  if (ret < 0) perror("read accel");
+};
+
+#define CLASSIC_STICK_SCALE ABS_RANGE/24
+void wiimote::process_classic() {
+  int err = read_node(&classic, &wiimote::classic_event);
+  if (err == ENODEV) {
+    close(classic.fd);
+    classic.fd = -1;
+    return;
+  }
+  if (err && err != EAGAIN) perror("read classic ext");
 }
 
-#define IR_X_SCALE ABS_RANGE/500
-#define IR_Y_SCALE ABS_RANGE/350
-#define NO_IR_DATA 1023
-void wiimote::process_ir(int fd) {
-  struct input_event ev;
-  int ret;
-  while (ret = read(fd, &ev, sizeof(ev)) > 0) {
-    switch (ev.code) {
-    case ABS_HAT0X:
-      ircache[0].x = ev.value;
+void wiimote::classic_event(const input_event& ev) {
+  if (ev.type == EV_KEY) switch (ev.code) {
+    case KEY_LEFT:
+      send_value(cc_left, ev.value);
       break;
-    case ABS_HAT0Y:
-      ircache[0].y = ev.value;
+    case KEY_RIGHT:
+      send_value(cc_right, ev.value);
+      break;
+    case KEY_UP:
+      send_value(cc_up, ev.value);
+      break;
+    case KEY_DOWN:
+      send_value(cc_down, ev.value);
+      break;
+    case BTN_A:
+      send_value(cc_a, ev.value);
+      break;
+    case BTN_B:
+      send_value(cc_b, ev.value);
+      break;
+    case BTN_X:
+      send_value(cc_x, ev.value);
+      break;
+    case BTN_Y:
+      send_value(cc_y, ev.value);
       break;
+    case KEY_PREVIOUS:
+      send_value(cc_minus, ev.value);
+      break;
+    case KEY_NEXT:
+      send_value(cc_plus, ev.value);
+      break;
+    case BTN_MODE:
+      send_value(cc_home, ev.value);
+      break;
+    case BTN_TL:
+      send_value(cc_l, ev.value);
+      break;
+    case BTN_TR:
+      send_value(cc_r, ev.value);
+      break;
+    case BTN_TL2:
+      send_value(cc_zl, ev.value);
+      break;
+    case BTN_TR2:
+      send_value(cc_zr, ev.value);
+      break;
+    }
+  else if (ev.type == EV_ABS) switch (ev.code) {
     case ABS_HAT1X:
-      ircache[1].x = ev.value;
+      send_value(cc_left_x, ev.value * CLASSIC_STICK_SCALE);
       break;
     case ABS_HAT1Y:
-      ircache[1].y = ev.value;
+      send_value(cc_left_y, -ev.value * CLASSIC_STICK_SCALE);
       break;
     case ABS_HAT2X:
-      ircache[2].x = ev.value;
+      send_value(cc_right_x, ev.value * CLASSIC_STICK_SCALE);
       break;
     case ABS_HAT2Y:
-      ircache[2].y = ev.value;
+      send_value(cc_right_y, -ev.value * CLASSIC_STICK_SCALE);
       break;
-    case ABS_HAT3X:
-      ircache[3].x = ev.value;
+    }
+  else {
+    methods.send_syn_report(ref);
+  }
+}
+
+#define NUNCHUK_STICK_SCALE ABS_RANGE/24
+#define NUNCHUK_ACCEL_SCALE ABS_RANGE/90
+void wiimote::process_nunchuk() {
+  int err = read_node(&nunchuk, &wiimote::nunchuk_event);
+  if (err == ENODEV) {
+    close(nunchuk.fd);
+    nunchuk.fd = -1;
+    return;
+  }
+  if (err && err != EAGAIN) perror("read nunchuk");
+}
+
+void wiimote::nunchuk_event(const input_event& ev) {
+  if (ev.type == EV_KEY) switch (ev.code) {
+    case BTN_C:
+      send_value(nk_c, ev.value);
+      break;
+    case BTN_Z:
+      send_value(nk_z, ev.value);
+      break;
+    }
+  else if (ev.type == EV_ABS) switch (ev.code) {
+    case ABS_HAT0X:
+      send_value(nk_stick_x, ev.value * NUNCHUK_STICK_SCALE);
+      break;
+    case ABS_HAT0Y:
+      send_value(nk_stick_y, -ev.value * NUNCHUK_STICK_SCALE);
+      break;
+    case ABS_RX:
+      send_value(nk_accel_x, ev.value * NUNCHUK_ACCEL_SCALE);
       break;
-    case ABS_HAT3Y:
-      ircache[3].y = ev.value;
+    case ABS_RY:
+      send_value(nk_accel_y, ev.value * NUNCHUK_ACCEL_SCALE);
       break;
-    case SYN_REPORT:
-      compute_ir();
-      methods.send_syn_report(ref);
+    case ABS_RZ:
+      send_value(nk_accel_z, ev.value * NUNCHUK_ACCEL_SCALE);
       break;
     }
+  else {
+    methods.send_syn_report(ref);
+  }
+}
+
+#define WIIMOTE_ACCEL_SCALE ABS_RANGE/90
+void wiimote::process_accel() {
+  int err = read_node(&accel, &wiimote::accel_event);
+  if (err && err != EAGAIN) perror("read accel");
+}
+
+void wiimote::accel_event(const input_event& ev) {
+  int offset = 0;
+
+  if (mode == NUNCHUK_EXT) {
+    offset = nk_wm_accel_x;
+  } else {
+    offset = wm_accel_x;
+  }
+  switch (ev.code) {
+  case ABS_RX:
+    send_value(offset + 0, ev.value * WIIMOTE_ACCEL_SCALE);
+    break;
+  case ABS_RY:
+    send_value(offset + 1, ev.value * WIIMOTE_ACCEL_SCALE);
+    break;
+  case ABS_RZ:
+    send_value(offset + 2, ev.value * WIIMOTE_ACCEL_SCALE);
+    break;
+  case SYN_REPORT:
+    methods.send_syn_report(ref);
+  }
+}
+
+#define IR_X_SCALE ABS_RANGE/500
+#define IR_Y_SCALE ABS_RANGE/350
+#define NO_IR_DATA 1023
+void wiimote::process_ir() {
+  int err = read_node(&ir, &wiimote::ir_event);
+  if (err && err != EAGAIN) perror("read IR");
+}
+
+void wiimote::ir_event(const input_event& ev) {
+  switch (ev.code) {
+  case ABS_HAT0X:
+    ircache[0].x = ev.value;
+    break;
+  case ABS_HAT0Y:
+    ircache[0].y = ev.value;
+    break;
+  case ABS_HAT1X:
+    ircache[1].x = ev.value;
+    break;
+  case ABS_HAT1Y:
+    ircache[1].y = ev.value;
+    break;
+  case ABS_HAT2X:
+    ircache[2].x = ev.value;
+    break;
+  case ABS_HAT2Y:
+    ircache[2].y = ev.value;
+    break;
+  case ABS_HAT3X:
+    ircache[3].x = ev.value;
+    break;
+  case ABS_HAT3Y:
+    ircache[3].y = ev.value;
+    break;
+  case SYN_REPORT:
+    compute_ir();
+    methods.send_syn_report(ref);
+    break;
   }
-  if (ret < 0) perror("read IR");
 }
 
 void wiimote::compute_ir() {
@@ -383,30 +449,30 @@ void wiimote::compute_ir() {
 
 #define BAL_X_SCALE ABS_RANGE
 #define BAL_Y_SCALE ABS_RANGE
-void wiimote::process_balance(int fd) {
-  struct input_event ev;
-  int ret;
-  while (ret = read(fd, &ev, sizeof(ev)) > 0) {
-    switch (ev.code) {
-    case ABS_HAT0X:
-      balancecache[0] = ev.value;
-      break;
-    case ABS_HAT0Y:
-      balancecache[1] = ev.value;
-      break;
-    case ABS_HAT1X:
-      balancecache[2] = ev.value;
-      break;
-    case ABS_HAT1Y:
-      balancecache[3] = ev.value;
-      break;
-    case SYN_REPORT:
-      compute_balance();
-      methods.send_syn_report(ref);
-      break;
-    }
+void wiimote::process_balance() {
+  int err = read_node(&balance, &wiimote::balance_event);
+  if (err && err != EAGAIN) perror("read balance board");
+}
+
+void wiimote::balance_event(const input_event& ev) {
+  switch (ev.code) {
+  case ABS_HAT0X:
+    balancecache[0] = ev.value;
+    break;
+  case ABS_HAT0Y:
+    balancecache[1] = ev.value;
+    break;
+  case ABS_HAT1X:
+    balancecache[2] = ev.value;
+    break;
+  case ABS_HAT1Y:
+    balancecache[3] = ev.value;
+    break;
+  case SYN_REPORT:
+    compute_balance();
+    methods.send_syn_report(ref);
+    break;
   }
-  if (ret < 0) perror("read balance board");
 }
 
 void wiimote::compute_balance() {
@@ -432,82 +498,81 @@ void wiimote::compute_balance() {
 }
 
 #define PRO_STICK_SCALE 32
-void wiimote::process_pro(int fd) {
-  struct input_event ev;
-  int ret = read(fd, &ev, sizeof(ev));
-  if (ret > 0) {
-
-    if (ev.type == EV_KEY) switch (ev.code) {
-      case BTN_DPAD_LEFT:
-        send_value(cc_left, ev.value);
-        break;
-      case BTN_DPAD_RIGHT:
-        send_value(cc_right, ev.value);
-        break;
-      case BTN_DPAD_UP:
-        send_value(cc_up, ev.value);
-        break;
-      case BTN_DPAD_DOWN:
-        send_value(cc_down, ev.value);
-        break;
-      case BTN_EAST:
-        send_value(cc_a, ev.value);
-        break;
-      case BTN_SOUTH:
-        send_value(cc_b, ev.value);
-        break;
-      case BTN_NORTH:
-        send_value(cc_x, ev.value);
-        break;
-      case BTN_WEST:
-        send_value(cc_y, ev.value);
-        break;
-      case BTN_SELECT:
-        send_value(cc_minus, ev.value);
-        break;
-      case BTN_START:
-        send_value(cc_plus, ev.value);
-        break;
-      case BTN_MODE:
-        send_value(cc_home, ev.value);
-        break;
-      case BTN_TL:
-        send_value(cc_l, ev.value);
-        break;
-      case BTN_TR:
-        send_value(cc_r, ev.value);
-        break;
-      case BTN_TL2:
-        send_value(cc_zl, ev.value);
-        break;
-      case BTN_TR2:
-        send_value(cc_zr, ev.value);
-        break;
-      case BTN_THUMBL:
-        send_value(cc_thumbl, ev.value);
-        break;
-      case BTN_THUMBR:
-        send_value(cc_thumbr, ev.value);
-        break;
-      }
-    else if (ev.type == EV_ABS) switch (ev.code) {
-      case ABS_X:
-        send_value(cc_left_x, ev.value * PRO_STICK_SCALE);
-        break;
-      case ABS_Y:
-        send_value(cc_left_y, ev.value * PRO_STICK_SCALE);
-        break;
-      case ABS_RX:
-        send_value(cc_right_x, ev.value * PRO_STICK_SCALE);
-        break;
-      case ABS_RY:
-        send_value(cc_right_y, ev.value * PRO_STICK_SCALE);
-        break;
-      }
-    else {
-      methods.send_syn_report(ref);
-    }
+void wiimote::process_pro() {
+  int err = read_node(&pro, &wiimote::pro_event);
+  if (err && err != EAGAIN && err != ENODEV) perror("read pro");
+}
 
+void wiimote::pro_event(const input_event& ev) {
+  if (ev.type == EV_KEY) switch (ev.code) {
+    case BTN_DPAD_LEFT:
+      send_value(cc_left, ev.value);
+      break;
+    case BTN_DPAD_RIGHT:
+      send_value(cc_right, ev.value);
+      break;
+    case BTN_DPAD_UP:
+      send_value(cc_up, ev.value);
+      break;
+    case BTN_DPAD_DOWN:
+      send_value(cc_down, ev.value);
+      break;
+    case BTN_EAST:
+      send_value(cc_a, ev.value);
+      break;
+    case BTN_SOUTH:
+      send_value(cc_b, ev.value);
+      break;
+    case BTN_NORTH:
+      send_value(cc_x, ev.value);
+      break;
+    case BTN_WEST:
+      send_value(cc_y, ev.value);
+      break;
+    case BTN_SELECT:
+      send_value(cc_minus, ev.value);
+      break;
+    case BTN_START:
+      send_value(cc_plus, ev.value);
+      break;
+    case BTN_MODE:
+      send_value(cc_home, ev.value);
+      break;
+    case BTN_TL:
+      send_value(cc_l, ev.value);
+      break;
+    case BTN_TR:
+      send_value(cc_r, ev.value);
+      break;
+    case BTN_TL2:
+      send_value(cc_zl, ev.value);
+      break;
+    case BTN_TR2:
+      send_value(cc_zr, ev.value);
+      break;
+    case BTN_THUMBL:
+      send_value(cc_thumbl, ev.value);
+      break;
+    case BTN_THUMBR:
+      send_value(cc_thumbr, ev.value);
+      break;
+    }
+  else if (ev.type == EV_ABS) switch (ev.code) {
+    case ABS_X:
+      send_value(cc_left_x, ev.value * PRO_STICK_SCALE);
+      break;
+    case ABS_Y:
+      send_value(cc_left_y, ev.value * PRO_STICK_SCALE);
+      break;
+    case ABS_RX:
+      send_value(cc_right_x, ev.value * PRO_STICK_SCALE);
+      break;
+    case ABS_RY:
+      send_value(cc_right_y, ev.value * PRO_STICK_SCALE);
+      break;
+    }
+  else {
+    methods.send_syn_report(ref);
   }
 }
 #include <iostream>
@@ -61,6 +61,7 @@ void wiimote::clear_node(struct dev_node* node) {
   node->dev = nullptr;
   if (node->fd >= 0) close(node->fd);
   node->fd = -1;
+  node->dropped = false;
 }
 
 const char* wiimote::get_description() const {
@@ -345,6 +346,7 @@ void wiimote::open_node(struct dev_node* node) {
   int mode = O_RDONLY;
   if (node == &buttons || node == &pro)
     mode = O_RDWR;
+  node->dropped = false;
   node->fd = open(udev_device_get_devnode(node->dev), mode | O_NONBLOCK | O_CLOEXEC);
   if (node->fd < 0 && mode == O_RDWR && errno == EACCES) {
     node->fd = open(udev_device_get_devnode(node->dev), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
@@ -412,22 +414,22 @@ void wiimote::process(void* tag) {
     process_core();
     break;
   case E_CC:
-    process_classic(classic.fd);
+    process_classic();
     break;
   case E_NK:
-    process_nunchuk(nunchuk.fd);
+    process_nunchuk();
     break;
   case IR:
-    process_ir(ir.fd);
+    process_ir();
     break;
   case ACCEL:
-    process_accel(accel.fd);
+    process_accel();
     break;
   case BALANCE:
-    process_balance(balance.fd);
+    process_balance();
     break;
   case WII_U_PRO:
-    process_pro(pro.fd);
+    process_pro();
     break;
   }
 }
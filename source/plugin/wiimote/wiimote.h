@@ -26,8 +26,12 @@ extern device_plugin wiidev;
 struct dev_node {
   struct udev_device* dev = nullptr;
   int fd = -1;
+  bool dropped = false; //Saw SYN_DROPPED, discarding events until the next SYN_REPORT.
 };
 
+//Most input_events taken from a node per read()
+#define WII_READ_BATCH 64
+
 
 
 enum ext_type {NUNCHUK, CLASSIC, GUITAR, DRUMS, UNKNOWN};
@@ -121,13 +125,22 @@ private:
   void send_value(int id, int64_t value) {
     methods.send_value(ref, id, value);
   };
+  int read_node(struct dev_node* node, void (wiimote::*handler)(const input_event&));
+  void resync_node(struct dev_node* node, void (wiimote::*handler)(const input_event&));
   void process_core();
-  void process_classic(int fd);
-  void process_nunchuk(int fd);
-  void process_accel(int fd);
-  void process_ir(int fd);
-  void process_pro(int fd);
-  void process_balance(int fd);
+  void process_classic();
+  void process_nunchuk();
+  void process_accel();
+  void process_ir();
+  void process_pro();
+  void process_balance();
+  void core_event(const input_event& ev);
+  void classic_event(const input_event& ev);
+  void nunchuk_event(const input_event& ev);
+  void accel_event(const input_event& ev);
+  void ir_event(const input_event& ev);
+  void pro_event(const input_event& ev);
+  void balance_event(const input_event& ev);
   void compute_ir();
   void compute_balance();
   void process(int type, int event_id, int64_t value);